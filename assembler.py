@@ -12,7 +12,9 @@ baseAddress = stackAddress = stackSize = heapAddress = heapSize = 0x0
 header = False
 
 doAssemble = False
-binaryFile = asciiFile = symbolFile = debugFile = None
+binaryFile = asciiFile = symbolFile = debugFile = dbiFile = None
+dbiLines = []   # (offset, line) for the binary debug info
+dbiSymbols = [] # (address, name) for the binary debug info
 
 def error(msg):
 	print >> sys.stderr, msg
@@ -41,10 +43,49 @@ def output(msg, trailer = ' '):
 def exportSymbol(label):
 	if symbolFile is not None:
 		symbolFile.write(".%s 0x%X\n" % (label, labels[label]))
+	dbiSymbols.append((labels[label], label))
 
 def exportDebug(lineNum, progOffset):
 	if debugFile is not None:
 		debugFile.write("%d 0x%X\n" % (lineNum, progOffset - baseAddress))
+	dbiLines.append((progOffset - baseAddress, lineNum))
+
+# Binary debug info, see dbi.h for the layout.
+DBI_MAGIC = 0x31494244
+DBI_VERSION = 1
+DBI_NONE = 0xFFFFFFFF
+
+def writeDebugBinary(sourceName):
+	lines = sorted(dbiLines)
+	maxLine = max([l for o, l in lines] + [0])
+	index = [DBI_NONE] * (maxLine + 1)
+	for o, l in lines:
+		if index[l] == DBI_NONE:
+			index[l] = o
+
+	strings = sourceName + '\0'
+	symbols = []
+	for address, name in sorted(dbiSymbols):
+		symbols.append((address, len(strings)))
+		strings += name + '\0'
+
+	headerSize = 12 * 4
+	linesAt = headerSize
+	indexAt = linesAt + len(lines) * 8
+	symbolsAt = indexAt + len(index) * 4
+	stringsAt = symbolsAt + len(symbols) * 8
+
+	dbiFile.write(struct.pack('<12I', DBI_MAGIC, DBI_VERSION, baseAddress, 0,
+		len(lines), linesAt, maxLine, indexAt,
+		len(symbols), symbolsAt, len(strings), stringsAt))
+	for o, l in lines:
+		dbiFile.write(struct.pack('<II', o, l))
+	for o in index:
+		dbiFile.write(struct.pack('<I', o))
+	for address, name in symbols:
+		dbiFile.write(struct.pack('<II', address, name))
+	dbiFile.write(strings)
+	dbiFile.close()
 
 def parseISA():
 	parse = 0
@@ -264,6 +305,7 @@ options = [
 	('t','text','Output machine code to ascii binary file.'),
 	('e','symbols','Output exported symbols to ABI file.'),
 	('g','debug','Output debug info to file.'),
+	('x','debug-binary','Output debug info and exported symbols to one binary file.'),
 	('s:','base-address','Base address where the binary will start in memory.')]
 shortOpt = "".join([opt[0] for opt in options])
 longOpt = [opt[1] for opt in options]
@@ -277,7 +319,7 @@ def usage():
 	sys.exit(1)
 
 def main():
-	global binaryFile, asciiFile, symbolFile, debugFile
+	global binaryFile, asciiFile, symbolFile, debugFile, dbiFile
 	global baseAddress
 	base = None
 
@@ -307,6 +349,8 @@ def main():
 			symbolFile = open(base + '.sym', "w")
 		elif o in ('-g', '--debug'):
 			debugFile = open(base + '.debug', "w")
+		elif o in ('-x', '--debug-binary'):
+			dbiFile = open(base + '.dbi', "wb")
 
 		elif o in ('-s', '--base-address'):
 			baseAddress = int(a, 0)
@@ -326,6 +370,8 @@ def main():
 
 	if doAssemble:
 		assemble(source)
+		if dbiFile is not None:
+			writeDebugBinary(os.path.basename(source.name))
 
 if __name__ == "__main__":
 	main()
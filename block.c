@@ -0,0 +1,365 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "block.h"
+#include "blockio.h"
+#include "reverse.h"
+
+struct blockRequest {
+	uint32_t command;
+	uint64_t offset;
+	uint32_t address;
+	uint32_t length;
+};
+
+static struct cpuState *blockCPU;
+
+static uint32_t lba;
+static uint32_t buffer;
+static uint32_t count;
+static uint32_t status;
+
+static int imageFd = -1;
+static uint8_t *image;
+static uint64_t imageSize;
+static uint32_t capacity;
+
+/*
+ * Asynchronous mode: one request at a time is handed to the worker,
+ * which raises 'finished' when it is done. The emulator thread only
+ * reads that flag on every instruction.
+ */
+static int async;
+static pthread_t workerThread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static struct blockRequest request;
+static int requested;
+static int stopping;
+static int finished;
+
+/*
+ * Queued mode: a request is split into up to BLOCK_QUEUE_DEPTH chunks
+ * that go to the image file through blockio. 'outstanding' counts the
+ * chunks still in flight, 'failed' notes if any of them went wrong.
+ */
+static int queued;
+static int forcePool;
+static uint32_t chunkAddress[BLOCK_QUEUE_DEPTH];
+static uint32_t chunkLength[BLOCK_QUEUE_DEPTH];
+static unsigned outstanding;
+static int failed;
+
+static void transfer(struct blockRequest *r)
+{
+	uint8_t *mem = blockCPU->mem + r->address;
+	uint64_t inImage = 0;
+
+	/*
+	 * The last sector may be partial, the rest of it reads as zeros.
+	 */
+	if (r->offset < imageSize) {
+		inImage = imageSize - r->offset < r->length ? imageSize - r->offset : r->length;
+	}
+
+	if (r->command == BLOCK_READ) {
+		memcpy(mem, image + r->offset, inImage);
+		memset(mem + inImage, 0, r->length - inImage);
+	} else {
+		memcpy(image + r->offset, mem, inImage);
+	}
+}
+
+static void *worker(void *arg)
+{
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (!requested && !stopping) {
+			pthread_cond_wait(&wake, &lock);
+		}
+		if (requested) {
+			requested = 0;
+			pthread_mutex_unlock(&lock);
+
+			transfer(&request);
+			__atomic_store_n(&finished, 1, __ATOMIC_RELEASE);
+
+			pthread_mutex_lock(&lock);
+			continue;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&lock);
+
+	return NULL;
+}
+
+void blockInit(struct cpuState *cpu)
+{
+	blockCPU = cpu;
+}
+
+int blockOpen(char *config)
+{
+	struct stat statBuffer;
+	char *path = strdup(config);
+	char *options;
+
+	if ((options = strchr(path, ',')) != NULL) {
+		*options++ = '\0';
+		if (strcmp(options, "async") == 0) {
+			async = 1;
+		} else if (strcmp(options, "uring") == 0) {
+			queued = 1;
+		} else if (strcmp(options, "pool") == 0) {
+			queued = 1;
+			forcePool = 1;
+		} else {
+			fprintf(stderr, "Unknown disk option '%s' (async, uring, pool)\n", options);
+			goto ERROR;
+		}
+	}
+
+	if (((imageFd = open(path, O_RDWR)) < 0) ||
+		(fstat(imageFd, &statBuffer) < 0)) {
+		fprintf(stderr, "Can't open disk image '%s': %s\n", path, strerror(errno));
+		goto ERROR;
+	}
+	imageSize = statBuffer.st_size;
+	capacity = (imageSize + BLOCK_SECTOR - 1) / BLOCK_SECTOR;
+
+	if (queued) {
+		if (blockioOpen(imageFd, BLOCK_QUEUE_DEPTH, forcePool) < 0) {
+			goto ERROR;
+		}
+		if (!forcePool && strcmp(blockioBackend(), "io_uring") != 0) {
+			fprintf(stderr, "io_uring not available, disk uses a thread pool.\n");
+		}
+	} else if (imageSize != 0 &&
+		(image = mmap(NULL, imageSize, PROT_READ | PROT_WRITE, MAP_SHARED, imageFd, 0)) == MAP_FAILED) {
+		fprintf(stderr, "Can't map disk image '%s': %s\n", path, strerror(errno));
+		image = NULL;
+		goto ERROR;
+	}
+
+	if (async && pthread_create(&workerThread, NULL, worker, NULL) != 0) {
+		fprintf(stderr, "Can't start disk worker thread.\n");
+		goto ERROR;
+	}
+
+	free(path);
+	return 0;
+
+ERROR:
+	free(path);
+	return -1;
+}
+
+void blockClose()
+{
+	if (async) {
+		pthread_mutex_lock(&lock);
+		stopping = 1;
+		pthread_cond_signal(&wake);
+		pthread_mutex_unlock(&lock);
+		pthread_join(workerThread, NULL);
+		async = 0;
+	}
+	if (queued) {
+		blockioClose();
+		queued = 0;
+	}
+
+	if (image != NULL) {
+		msync(image, imageSize, MS_SYNC);
+		munmap(image, imageSize);
+		image = NULL;
+	}
+	if (imageFd >= 0) {
+		close(imageFd);
+		imageFd = -1;
+	}
+}
+
+static void complete(uint32_t result)
+{
+	status = result;
+	blockCPU->intPending |= 1 << INT_BLOCK;
+}
+
+/*
+ * Hand 'r' to blockio in sector aligned chunks. Reads past the end of
+ * the image are zero filled here, writes there are dropped, as in
+ * transfer().
+ */
+static void submitChunks(struct blockRequest *r)
+{
+	uint32_t sectors = (r->length / BLOCK_SECTOR + BLOCK_QUEUE_DEPTH - 1) / BLOCK_QUEUE_DEPTH;
+	uint32_t size = sectors * BLOCK_SECTOR;
+	uint32_t done, n, tag = 0;
+	uint64_t offset, inImage;
+
+	failed = 0;
+	for (done = 0; done < r->length; done += n, tag++) {
+		n = r->length - done < size ? r->length - done : size;
+		offset = r->offset + done;
+		inImage = 0;
+		if (offset < imageSize) {
+			inImage = imageSize - offset < n ? imageSize - offset : n;
+		}
+
+		if (r->command == BLOCK_READ) {
+			memset(blockCPU->mem + r->address + done + inImage, 0, n - inImage);
+		}
+		if (inImage == 0) {
+			continue;
+		}
+
+		chunkAddress[tag] = r->address + done;
+		chunkLength[tag] = inImage;
+		if (blockioSubmit(r->command == BLOCK_WRITE, offset, blockCPU->mem + r->address + done,
+		                  inImage, tag) < 0) {
+			failed = 1;
+			break;
+		}
+		outstanding++;
+	}
+
+	if (outstanding == 0) {
+		complete(BLOCK_DONE | (failed ? BLOCK_ERROR : 0));
+	} else {
+		status = BLOCK_BUSY;
+	}
+}
+
+static void startCommand(uint32_t command)
+{
+	struct blockRequest r;
+
+	if ((command != BLOCK_READ && command != BLOCK_WRITE) ||
+		((uint64_t)lba + count > capacity) ||
+		!isMemory(blockCPU, buffer, (uint64_t)count * BLOCK_SECTOR)) {
+		complete(BLOCK_DONE | BLOCK_ERROR);
+		return;
+	}
+
+	r.command = command;
+	r.offset = (uint64_t)lba * BLOCK_SECTOR;
+	r.address = buffer;
+	r.length = count * BLOCK_SECTOR;
+
+	/*
+	 * Reads may land in guest memory from another thread or the kernel,
+	 * so the buffer is saved for reverse execution before they start.
+	 */
+	if (command == BLOCK_READ) {
+		reverseWriteRange(r.address, r.length);
+	}
+
+	if (queued) {
+		submitChunks(&r);
+		return;
+	}
+
+	if (!async || count == 0) {
+		transfer(&r);
+		complete(BLOCK_DONE);
+		return;
+	}
+
+	status = BLOCK_BUSY;
+	pthread_mutex_lock(&lock);
+	request = r;
+	requested = 1;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+}
+
+uint32_t blockRead(uint32_t offset)
+{
+	switch (offset & ~0x3) {
+		case BLOCK_LBA:
+			return lba;
+		case BLOCK_BUFFER:
+			return buffer;
+		case BLOCK_COUNT:
+			return count;
+		case BLOCK_STATUS:
+			return status;
+		case BLOCK_CAPACITY:
+			return capacity;
+		default:
+			return 0;
+	}
+}
+
+void blockWrite(uint32_t offset, uint32_t data)
+{
+	/*
+	 * Registers are latched while a request is in progress.
+	 */
+	if (status & BLOCK_BUSY) {
+		return;
+	}
+
+	switch (offset & ~0x3) {
+		case BLOCK_LBA:
+			lba = data;
+			break;
+		case BLOCK_BUFFER:
+			buffer = data;
+			break;
+		case BLOCK_COUNT:
+			count = data;
+			break;
+		case BLOCK_COMMAND:
+			startCommand(data);
+			break;
+		case BLOCK_STATUS:
+			status = 0;
+			break;
+	}
+}
+
+int blockBusy()
+{
+	return (status & BLOCK_BUSY) != 0;
+}
+
+void blockTick()
+{
+	uint32_t tag;
+	int32_t result;
+
+	if (queued) {
+		while (blockioReap(&tag, &result)) {
+			outstanding--;
+			if (result < 0) {
+				failed = 1;
+			} else if ((uint32_t)result < chunkLength[tag]) {
+				/*
+				 * The image shrank under us, the rest reads as zeros.
+				 */
+				reverseWriteRange(chunkAddress[tag] + result, chunkLength[tag] - result);
+				memset(blockCPU->mem + chunkAddress[tag] + result, 0, chunkLength[tag] - result);
+			}
+		}
+		if (outstanding == 0) {
+			complete(BLOCK_DONE | (failed ? BLOCK_ERROR : 0));
+		}
+		return;
+	}
+
+	if (__atomic_load_n(&finished, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&finished, 0, __ATOMIC_RELAXED);
+		complete(BLOCK_DONE);
+	}
+}
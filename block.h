@@ -0,0 +1,74 @@
+#ifndef __BLOCK_H
+#define __BLOCK_H
+
+#include "cpu.h"
+
+/*
+ * Block device registers, relative to the memory mapped I/O region.
+ *
+ * Writing BLOCK_READ or BLOCK_WRITE to Command transfers Count sectors
+ * starting at sector LBA of the disk image from/to the absolute guest
+ * address in Buffer. When it completes, Status reads BLOCK_DONE (with
+ * BLOCK_ERROR if the request was out of range) and the INT_BLOCK
+ * interrupt becomes pending. Capacity is the image size in sectors.
+ */
+#define BLOCK_BASE        0xBC
+#define BLOCK_SIZE        0x18
+
+#define BLOCK_LBA         0x0
+#define BLOCK_BUFFER      0x4
+#define BLOCK_COUNT       0x8
+#define BLOCK_COMMAND     0xC
+#define BLOCK_STATUS      0x10
+#define BLOCK_CAPACITY    0x14
+
+#define BLOCK_READ        0x1
+#define BLOCK_WRITE       0x2
+
+#define BLOCK_BUSY        0x1
+#define BLOCK_DONE        0x2
+#define BLOCK_ERROR       0x4
+
+#define BLOCK_SECTOR      512
+
+#define BLOCK_QUEUE_DEPTH 32
+
+void blockInit(struct cpuState *cpu);
+
+/*
+ * Serve the block device from the image 'config', given as
+ * <imagePath>[,async|uring|pool]. The image is mapped, so writes end
+ * up in the file. With async, transfers run on a worker thread while
+ * the guest keeps executing. With uring (or pool), the image is not
+ * mapped: each request is split into chunks that are read or written
+ * concurrently through io_uring (or a thread pool, which uring also
+ * falls back to).
+ *
+ * Without a call to blockOpen() the device has no media and every
+ * request fails.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int blockOpen(char *config);
+
+/*
+ * Wait for any transfer in flight and unmap the image.
+ */
+void blockClose();
+
+uint32_t blockRead(uint32_t offset);
+void blockWrite(uint32_t offset, uint32_t data);
+
+/*
+ * Returns 1 while a request is in progress.
+ */
+int blockBusy();
+
+/*
+ * Check for completion of the request in progress. Called once per
+ * instruction while busy.
+ */
+void blockTick();
+
+#endif /* __BLOCK_H */
@@ -0,0 +1,385 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "blockio.h"
+
+#define POOL_THREADS 4
+
+struct blockioRequest {
+	int write;
+	uint64_t offset;
+	void *buffer;
+	uint32_t length;
+	uint32_t tag;
+	int32_t result;
+};
+
+static int imageFd = -1;
+static unsigned queueDepth;
+static unsigned outstanding;
+static int usingUring;
+
+/*
+ * io_uring state. Each submission slot owns an iovec that stays valid
+ * until the request completes.
+ */
+static int ringFd = -1;
+static void *sqRing;
+static void *cqRing;
+static size_t sqRingSize;
+static size_t cqRingSize;
+static struct io_uring_sqe *sqes;
+static size_t sqesSize;
+static unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+static unsigned *cqHead, *cqTail, *cqMask;
+static struct io_uring_cqe *cqes;
+static struct iovec *iovecs;
+
+/*
+ * Thread pool state: a ring of submitted requests and a ring of
+ * completed ones, both 'queueDepth' long. 'completed' lets the emulator
+ * thread check for completions without taking the lock.
+ */
+static pthread_t threads[POOL_THREADS];
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolWake = PTHREAD_COND_INITIALIZER;
+static struct blockioRequest *submitted;
+static struct blockioRequest *done;
+static unsigned submitHead, submitTail;
+static unsigned doneHead, doneTail;
+static unsigned completed;
+static int poolStopping;
+
+static int ioUringSetup(unsigned entries, struct io_uring_params *params)
+{
+	return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ioUringEnter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, ringFd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int uringOpen(unsigned depth)
+{
+	struct io_uring_params params;
+
+	memset(&params, 0, sizeof(params));
+	if ((ringFd = ioUringSetup(depth, &params)) < 0) {
+		return -1;
+	}
+
+	sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cqRingSize > sqRingSize) {
+			sqRingSize = cqRingSize;
+		}
+		cqRingSize = sqRingSize;
+	}
+
+	sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	              ringFd, IORING_OFF_SQ_RING);
+	if (sqRing == MAP_FAILED) {
+		sqRing = NULL;
+		return -1;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		cqRing = sqRing;
+	} else if ((cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                          ringFd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+		cqRing = NULL;
+		return -1;
+	}
+
+	sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	sqes = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	            ringFd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		sqes = NULL;
+		return -1;
+	}
+
+	sqHead = sqRing + params.sq_off.head;
+	sqTail = sqRing + params.sq_off.tail;
+	sqMask = sqRing + params.sq_off.ring_mask;
+	sqArray = sqRing + params.sq_off.array;
+	cqHead = cqRing + params.cq_off.head;
+	cqTail = cqRing + params.cq_off.tail;
+	cqMask = cqRing + params.cq_off.ring_mask;
+	cqes = cqRing + params.cq_off.cqes;
+
+	if ((iovecs = calloc(params.sq_entries, sizeof(*iovecs))) == NULL) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static void uringClose()
+{
+	if (sqes != NULL) {
+		munmap(sqes, sqesSize);
+	}
+	if (cqRing != NULL && cqRing != sqRing) {
+		munmap(cqRing, cqRingSize);
+	}
+	if (sqRing != NULL) {
+		munmap(sqRing, sqRingSize);
+	}
+	if (ringFd >= 0) {
+		close(ringFd);
+	}
+	free(iovecs);
+
+	sqes = NULL;
+	sqRing = cqRing = NULL;
+	ringFd = -1;
+	iovecs = NULL;
+}
+
+static int uringSubmit(int write, uint64_t offset, void *buffer, uint32_t length, uint32_t tag)
+{
+	unsigned tail = *sqTail;
+	unsigned index = tail & *sqMask;
+	struct io_uring_sqe *sqe = &sqes[index];
+
+	iovecs[index].iov_base = buffer;
+	iovecs[index].iov_len = length;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+	sqe->fd = imageFd;
+	sqe->off = offset;
+	sqe->addr = (uintptr_t)&iovecs[index];
+	sqe->len = 1;
+	sqe->user_data = tag;
+
+	sqArray[index] = index;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+	/*
+	 * Without SQ polling the kernel only takes entries in io_uring_enter,
+	 * so if it failed before taking this one, nothing else can submit it
+	 * later and it is taken back. Once taken it completes, and counts as
+	 * submitted.
+	 */
+	while (ioUringEnter(1, 0, 0) < 0) {
+		if (errno == EINTR) {
+			continue;
+		}
+		if (__atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == tail) {
+			__atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+			return -1;
+		}
+		break;
+	}
+	return 0;
+}
+
+static int uringReap(uint32_t *tag, int32_t *result)
+{
+	unsigned head = *cqHead;
+	struct io_uring_cqe *cqe;
+
+	if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+	cqe = &cqes[head & *cqMask];
+	*tag = cqe->user_data;
+	*result = cqe->res;
+	__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+static void *poolWorker(void *arg)
+{
+	struct blockioRequest r;
+	ssize_t n;
+
+	pthread_mutex_lock(&poolLock);
+	for (;;) {
+		while (submitHead == submitTail && !poolStopping) {
+			pthread_cond_wait(&poolWake, &poolLock);
+		}
+		if (submitHead == submitTail) {
+			break;
+		}
+		r = submitted[submitHead++ % queueDepth];
+		pthread_mutex_unlock(&poolLock);
+
+		if (r.write) {
+			n = pwrite(imageFd, r.buffer, r.length, r.offset);
+		} else {
+			n = pread(imageFd, r.buffer, r.length, r.offset);
+		}
+		r.result = n < 0 ? -errno : n;
+
+		pthread_mutex_lock(&poolLock);
+		done[doneTail++ % queueDepth] = r;
+		__atomic_add_fetch(&completed, 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&poolLock);
+
+	return NULL;
+}
+
+static int poolOpen()
+{
+	int i;
+
+	submitted = calloc(queueDepth, sizeof(*submitted));
+	done = calloc(queueDepth, sizeof(*done));
+	if (submitted == NULL || done == NULL) {
+		return -1;
+	}
+
+	for (i = 0; i < POOL_THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, poolWorker, NULL) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void poolClose()
+{
+	int i;
+
+	pthread_mutex_lock(&poolLock);
+	poolStopping = 1;
+	pthread_cond_broadcast(&poolWake);
+	pthread_mutex_unlock(&poolLock);
+
+	for (i = 0; i < POOL_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+
+	free(submitted);
+	free(done);
+	submitted = done = NULL;
+}
+
+static int poolSubmit(int write, uint64_t offset, void *buffer, uint32_t length, uint32_t tag)
+{
+	struct blockioRequest r = {write, offset, buffer, length, tag, 0};
+
+	pthread_mutex_lock(&poolLock);
+	submitted[submitTail++ % queueDepth] = r;
+	pthread_cond_signal(&poolWake);
+	pthread_mutex_unlock(&poolLock);
+
+	return 0;
+}
+
+static int poolReap(uint32_t *tag, int32_t *result)
+{
+	if (__atomic_load_n(&completed, __ATOMIC_ACQUIRE) == 0) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&poolLock);
+	*tag = done[doneHead % queueDepth].tag;
+	*result = done[doneHead % queueDepth].result;
+	doneHead++;
+	__atomic_sub_fetch(&completed, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&poolLock);
+
+	return 1;
+}
+
+int blockioOpen(int fd, unsigned depth, int pool)
+{
+	imageFd = fd;
+	queueDepth = depth;
+	outstanding = 0;
+
+	if (!pool && uringOpen(depth) == 0) {
+		usingUring = 1;
+		return 0;
+	}
+	uringClose();
+
+	if (poolOpen() < 0) {
+		fprintf(stderr, "Can't start disk I/O threads: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+const char *blockioBackend()
+{
+	return usingUring ? "io_uring" : "thread pool";
+}
+
+int blockioSubmit(int write, uint64_t offset, void *buffer, uint32_t length, uint32_t tag)
+{
+	int ret;
+
+	if (outstanding >= queueDepth) {
+		return -1;
+	}
+
+	if (usingUring) {
+		ret = uringSubmit(write, offset, buffer, length, tag);
+	} else {
+		ret = poolSubmit(write, offset, buffer, length, tag);
+	}
+	if (ret == 0) {
+		outstanding++;
+	}
+	return ret;
+}
+
+int blockioReap(uint32_t *tag, int32_t *result)
+{
+	int ret;
+
+	if (outstanding == 0) {
+		return 0;
+	}
+
+	if (usingUring) {
+		ret = uringReap(tag, result);
+	} else {
+		ret = poolReap(tag, result);
+	}
+	outstanding -= ret;
+
+	return ret;
+}
+
+void blockioClose()
+{
+	uint32_t tag;
+	int32_t result;
+
+	if (imageFd < 0) {
+		return;
+	}
+
+	while (outstanding != 0) {
+		if (blockioReap(&tag, &result) == 0 && usingUring) {
+			ioUringEnter(0, 1, IORING_ENTER_GETEVENTS);
+		}
+	}
+
+	if (usingUring) {
+		uringClose();
+	} else {
+		poolClose();
+	}
+	usingUring = 0;
+	imageFd = -1;
+}
@@ -0,0 +1,46 @@
+#ifndef __BLOCKIO_H
+#define __BLOCKIO_H
+
+#include <inttypes.h>
+
+/*
+ * Asynchronous reads and writes on the disk image file for the block
+ * device. Requests go through io_uring (set up with raw system calls)
+ * and fall back to a pool of threads doing pread/pwrite when io_uring
+ * is not available or 'pool' is set.
+ *
+ * At most 'depth' requests may be outstanding.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int blockioOpen(int fd, unsigned depth, int pool);
+
+/*
+ * Returns the name of the backend in use.
+ */
+const char *blockioBackend();
+
+/*
+ * Queue a read (or write) of 'length' bytes at file 'offset' into (from)
+ * 'buffer'. 'tag' is handed back on completion.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int blockioSubmit(int write, uint64_t offset, void *buffer, uint32_t length, uint32_t tag);
+
+/*
+ * Fetch one completion without blocking. 'result' is the number of bytes
+ * transferred or a negative errno.
+ *
+ * Returns 1 if a completion was fetched, 0 if none is ready.
+ */
+int blockioReap(uint32_t *tag, int32_t *result);
+
+/*
+ * Wait for every outstanding request, then release the backend.
+ */
+void blockioClose();
+
+#endif /* __BLOCKIO_H */
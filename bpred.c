@@ -0,0 +1,330 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "bpred.h"
+#include "timing.h"
+#include "symbols.h"
+#include "debugger.h"
+#include "isa.h"
+
+#define PREDICT_STATIC  0
+#define PREDICT_BIMODAL 1
+#define PREDICT_GSHARE  2
+
+#define BPRED_TOP_BRANCHES 20
+
+static char *predictorNames[] = {"static", "bimodal", "gshare"};
+
+typedef struct BranchStats
+{
+	uint32_t pc;
+	uint8_t op;
+	uint8_t indirect;
+	uint64_t count;
+	uint64_t taken;
+	uint64_t mispredicts;
+} BranchStats;
+
+typedef struct ClassStats
+{
+	uint64_t count;
+	uint64_t mispredicts;
+} ClassStats;
+
+static int predictor;
+static int tableBits = 10;
+static uint32_t tableMask;
+
+/*
+ * Two bit saturating counters (0-1 not taken, 2-3 taken) and the global
+ * history used by gshare.
+ */
+static uint8_t *counters;
+static uint32_t history;
+
+/*
+ * Direct-mapped branch target buffer.
+ */
+static uint32_t *btbTag;
+static uint32_t *btbTarget;
+static uint8_t *btbValid;
+
+/*
+ * Open addressing hash table of per-branch statistics keyed by PC.
+ */
+static BranchStats *branches;
+static uint32_t branchAlloc;
+static uint32_t branchCount;
+
+static ClassStats conditional;
+static ClassStats indirect;
+static ClassStats direct;
+
+int bpredInit(char *config)
+{
+	char name[64];
+	int i;
+
+	if (sscanf(config, "%63[a-z]:%d", name, &tableBits) < 1) {
+		fprintf(stderr, "Expected predictor as static, bimodal[:<bits>] or gshare[:<bits>]\n");
+		return -1;
+	}
+	if (tableBits < 1 || tableBits > 24) {
+		fprintf(stderr, "Predictor table bits must be between 1 and 24.\n");
+		return -1;
+	}
+
+	predictor = -1;
+	for (i = 0; i < sizeof(predictorNames) / sizeof(*predictorNames); i++) {
+		if (strcmp(name, predictorNames[i]) == 0) {
+			predictor = i;
+		}
+	}
+	if (predictor < 0) {
+		fprintf(stderr, "Unknown branch predictor '%s'\n", name);
+		return -1;
+	}
+
+	tableMask = (1 << tableBits) - 1;
+	counters = malloc(tableMask + 1);
+	btbTag = calloc(tableMask + 1, sizeof(*btbTag));
+	btbTarget = calloc(tableMask + 1, sizeof(*btbTarget));
+	btbValid = calloc(tableMask + 1, sizeof(*btbValid));
+
+	branchAlloc = 1024;
+	branches = calloc(branchAlloc, sizeof(*branches));
+
+	if (!counters || !btbTag || !btbTarget || !btbValid || !branches) {
+		fprintf(stderr, "Can't allocate branch predictor: %s\n", strerror(errno));
+		return -1;
+	}
+	memset(counters, 1, tableMask + 1);
+
+	return 0;
+}
+
+static uint32_t hashPC(uint32_t pc)
+{
+	return (pc >> 2) * 2654435761u;
+}
+
+static BranchStats *findBranch(uint32_t pc);
+
+static void growBranches()
+{
+	BranchStats *old = branches;
+	uint32_t oldAlloc = branchAlloc;
+	uint32_t i;
+
+	branchAlloc *= 2;
+	if ((branches = calloc(branchAlloc, sizeof(*branches))) == NULL) {
+		fprintf(stderr, "Can't grow branch table: %s\n", strerror(errno));
+		abort();
+	}
+	branchCount = 0;
+
+	for (i = 0; i < oldAlloc; i++) {
+		if (old[i].count != 0) {
+			*findBranch(old[i].pc) = old[i];
+		}
+	}
+	free(old);
+}
+
+/*
+ * Returns the statistics slot for 'pc', claiming a new one if needed.
+ * A slot is in use once its count is non-zero.
+ */
+static BranchStats *findBranch(uint32_t pc)
+{
+	uint32_t mask = branchAlloc - 1;
+	uint32_t i = hashPC(pc) & mask;
+
+	while (branches[i].count != 0 && branches[i].pc != pc) {
+		i = (i + 1) & mask;
+	}
+
+	if (branches[i].count == 0) {
+		if ((branchCount + 1) * 10 > branchAlloc * 7) {
+			growBranches();
+			return findBranch(pc);
+		}
+		branches[i].pc = pc;
+		branchCount++;
+	}
+
+	return &branches[i];
+}
+
+static int predictDirection(uint32_t pc, uint32_t target)
+{
+	switch (predictor) {
+		case PREDICT_BIMODAL:
+			return counters[(pc >> 3) & tableMask] >= 2;
+		case PREDICT_GSHARE:
+			return counters[((pc >> 3) ^ history) & tableMask] >= 2;
+		default:
+			return target <= pc;
+	}
+}
+
+static void updateDirection(uint32_t pc, int taken)
+{
+	uint8_t *c;
+
+	if (predictor == PREDICT_STATIC) {
+		return;
+	}
+
+	if (predictor == PREDICT_GSHARE) {
+		c = &counters[((pc >> 3) ^ history) & tableMask];
+		history = ((history << 1) | taken) & tableMask;
+	} else {
+		c = &counters[(pc >> 3) & tableMask];
+	}
+
+	if (taken && *c < 3) {
+		(*c)++;
+	} else if (!taken && *c > 0) {
+		(*c)--;
+	}
+}
+
+/*
+ * Returns 1 if the branch target buffer predicts 'target' for 'pc' and
+ * remembers 'target' for next time.
+ */
+static int predictTarget(uint32_t pc, uint32_t target)
+{
+	uint32_t i = (pc >> 3) & tableMask;
+	int hit = btbValid[i] && btbTag[i] == pc && btbTarget[i] == target;
+
+	btbValid[i] = 1;
+	btbTag[i] = pc;
+	btbTarget[i] = target;
+
+	return hit;
+}
+
+int bpredBranch(uint32_t pc, uint8_t op, int isIndirect, int taken, uint32_t target)
+{
+	BranchStats *stats = findBranch(pc);
+	int miss = 0;
+
+	stats->op = op;
+	stats->indirect = isIndirect;
+	stats->count++;
+	stats->taken += taken;
+
+	if (op == jmp) {
+		if (isIndirect) {
+			miss = !predictTarget(pc, target);
+			indirect.count++;
+			indirect.mispredicts += miss;
+		} else {
+			direct.count++;
+		}
+	} else {
+		int predicted = predictDirection(pc, target);
+
+		miss = predicted != taken;
+		if (!miss && taken && isIndirect) {
+			miss = !predictTarget(pc, target);
+		}
+		updateDirection(pc, taken);
+
+		conditional.count++;
+		conditional.mispredicts += miss;
+	}
+
+	stats->mispredicts += miss;
+
+	return miss;
+}
+
+static int compareBranches(const void *a, const void *b)
+{
+	const BranchStats *l = a;
+	const BranchStats *r = b;
+
+	if (l->mispredicts != r->mispredicts) {
+		return l->mispredicts < r->mispredicts ? 1 : -1;
+	}
+	if (l->count != r->count) {
+		return l->count < r->count ? 1 : -1;
+	}
+	return l->pc < r->pc ? -1 : l->pc > r->pc;
+}
+
+static void printClass(FILE *stream, char *name, ClassStats *stats)
+{
+	fprintf(stream, "  %-12s %12" PRIu64 " executed %12" PRIu64 " mispredicted (%.2f%% accuracy)\n",
+	        name, stats->count, stats->mispredicts,
+	        stats->count == 0 ? 100.0 :
+	        100.0 * (stats->count - stats->mispredicts) / stats->count);
+}
+
+void bpredReport(FILE *stream)
+{
+	ClassStats all;
+	uint32_t i;
+
+	all.count = conditional.count + indirect.count + direct.count;
+	all.mispredicts = conditional.mispredicts + indirect.mispredicts;
+
+	fprintf(stream, "\nBranch prediction (%s, %d entry tables):\n",
+	        predictorNames[predictor], tableMask + 1);
+	printClass(stream, "conditional", &conditional);
+	printClass(stream, "indirect", &indirect);
+	printClass(stream, "direct jmp", &direct);
+	printClass(stream, "all", &all);
+
+	/*
+	 * Compact the hash table and sort it by mispredictions.
+	 */
+	branchCount = 0;
+	for (i = 0; i < branchAlloc; i++) {
+		if (branches[i].count != 0) {
+			branches[branchCount++] = branches[i];
+		}
+	}
+	qsort(branches, branchCount, sizeof(*branches), compareBranches);
+
+	fprintf(stream, "\n%-10s %-6s %12s %12s %12s %9s  %s\n", "pc", "op",
+	        "executed", "taken", "mispredicted", "accuracy", "source");
+	for (i = 0; i < branchCount && i < BPRED_TOP_BRANCHES; i++) {
+		BranchStats *b = &branches[i];
+		char *file;
+		int line;
+		int s = symbolsFind(b->pc);
+
+		fprintf(stream, "0x%-8" PRIX32 " %-3s%-3s %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %8.2f%% ",
+		        b->pc, opcodeName(b->op), b->indirect ? " r" : "",
+		        b->count, b->taken, b->mispredicts,
+		        100.0 * (b->count - b->mispredicts) / b->count);
+		if (mapOffsetToLine(b->pc, &file, &line) == 0) {
+			fprintf(stream, " %s:%d", file, line);
+		}
+		if (s >= 0) {
+			fprintf(stream, " (%s+0x%" PRIX32 ")", symbolsName(s), b->pc - symbolsAddress(s));
+		}
+		fprintf(stream, "\n");
+	}
+}
+
+void bpredFree()
+{
+	free(counters);
+	free(btbTag);
+	free(btbTarget);
+	free(btbValid);
+	free(branches);
+
+	counters = NULL;
+	btbTag = btbTarget = NULL;
+	btbValid = NULL;
+	branches = NULL;
+}
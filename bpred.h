@@ -0,0 +1,40 @@
+#ifndef __BPRED_H
+#define __BPRED_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+/*
+ * Simulate a branch predictor at every jmp/jz/jnz/jl/jge. 'config' is
+ *
+ *     static | bimodal[:<bits>] | gshare[:<bits>]
+ *
+ * where bits is log2 of the pattern table and branch target buffer
+ * sizes (default 10). static predicts backward branches taken and
+ * forward branches not taken. Register-indirect jumps such as the
+ * jmp r4 return are predicted by a direct-mapped branch target buffer.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int bpredInit(char *config);
+
+/*
+ * Record a resolved branch.
+ *
+ * Returns 1 if the branch was mispredicted, otherwise 0.
+ */
+int bpredBranch(uint32_t pc, uint8_t op, int indirect, int taken, uint32_t target);
+
+/*
+ * Print global accuracy and the worst predicted branches with their
+ * source lines.
+ */
+void bpredReport(FILE *stream);
+
+/*
+ * Release the predictor tables.
+ */
+void bpredFree();
+
+#endif /* __BPRED_H */
@@ -0,0 +1,272 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "cache.h"
+#include "symbols.h"
+
+#define POLICY_LRU    0
+#define POLICY_FIFO   1
+#define POLICY_RANDOM 2
+
+static char *policyNames[] = {"lru", "fifo", "random"};
+
+typedef struct CacheStats
+{
+	uint64_t accesses;
+	uint64_t misses;
+	uint64_t writeBacks;
+} CacheStats;
+
+typedef struct Cache
+{
+	int enabled;
+	uint32_t size;
+	uint32_t ways;
+	uint32_t lineSize;
+	uint32_t sets;
+	int policy;
+	uint32_t missPenalty;
+
+	int lineShift;
+
+	/*
+	 * sets * ways entries, each set is contiguous.
+	 */
+	uint32_t *tags;
+	uint8_t *valid;
+	uint8_t *dirty;
+	uint64_t *stamps;
+
+	uint64_t clock;
+	unsigned int seed;
+
+	CacheStats total;
+} Cache;
+
+static Cache caches[2];
+static char *cacheNames[] = {"I-cache", "D-cache"};
+
+/*
+ * Per function statistics, indexed by symbol. The last entry collects
+ * accesses made outside of any known function.
+ */
+static CacheStats *functionStats[2];
+static int numFunctions;
+static int currentFunction;
+
+static int isPowerOfTwo(uint32_t x)
+{
+	return (x != 0) && ((x & (x - 1)) == 0);
+}
+
+int cacheInit(int which, char *config)
+{
+	Cache *c = &caches[which];
+	char policy[64] = "lru";
+	uint32_t penalty = 0;
+	int i;
+
+	memset(c, 0, sizeof(*c));
+
+	if (sscanf(config, "%" SCNu32 ":%" SCNu32 ":%" SCNu32 ":%63[a-z]:%" SCNu32,
+	           &c->size, &c->ways, &c->lineSize, policy, &penalty) < 3) {
+		fprintf(stderr, "Expected cache as <size>:<ways>:<lineSize>[:<policy>[:<missPenalty>]]\n");
+		return -1;
+	}
+
+	/*
+	 * Dividing first keeps ways * lineSize from overflowing and makes
+	 * sure there is at least one set.
+	 */
+	if (!isPowerOfTwo(c->lineSize) || c->ways == 0 ||
+		(c->ways > c->size / c->lineSize) ||
+		(c->size % (c->ways * c->lineSize)) != 0) {
+		fprintf(stderr, "Cache size must be a non-zero multiple of ways * lineSize "
+		        "and lineSize a power of two.\n");
+		return -1;
+	}
+	c->sets = c->size / (c->ways * c->lineSize);
+
+	c->policy = -1;
+	for (i = 0; i < sizeof(policyNames) / sizeof(*policyNames); i++) {
+		if (strcmp(policy, policyNames[i]) == 0) {
+			c->policy = i;
+		}
+	}
+	if (c->policy < 0) {
+		fprintf(stderr, "Unknown replacement policy '%s' (lru, fifo, random)\n", policy);
+		return -1;
+	}
+
+	c->missPenalty = penalty != 0 ? penalty : 2 * c->lineSize;
+	c->lineShift = __builtin_ctz(c->lineSize);
+	c->seed = 1;
+
+	c->tags = calloc(c->sets * c->ways, sizeof(*c->tags));
+	c->valid = calloc(c->sets * c->ways, sizeof(*c->valid));
+	c->dirty = calloc(c->sets * c->ways, sizeof(*c->dirty));
+	c->stamps = calloc(c->sets * c->ways, sizeof(*c->stamps));
+	if (!c->tags || !c->valid || !c->dirty || !c->stamps) {
+		fprintf(stderr, "Can't allocate cache: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/*
+	 * Symbols are loaded before the caches are configured.
+	 */
+	numFunctions = symbolsCount();
+	currentFunction = numFunctions;
+	if ((functionStats[which] = calloc(numFunctions + 1, sizeof(CacheStats))) == NULL) {
+		fprintf(stderr, "Can't allocate cache statistics: %s\n", strerror(errno));
+		return -1;
+	}
+
+	c->enabled = 1;
+
+	return 0;
+}
+
+void cacheSetPC(uint32_t pc)
+{
+	int i = symbolsFind(pc);
+
+	currentFunction = i < 0 ? numFunctions : i;
+}
+
+static void accessLine(Cache *c, CacheStats *stats, uint32_t line, int write)
+{
+	uint32_t set = line % c->sets;
+	uint32_t tag = line / c->sets;
+	uint32_t base = set * c->ways;
+	uint32_t way;
+	uint32_t victim;
+
+	c->clock++;
+	c->total.accesses++;
+	stats->accesses++;
+
+	for (way = 0; way < c->ways; way++) {
+		if (c->valid[base + way] && c->tags[base + way] == tag) {
+			if (c->policy == POLICY_LRU) {
+				c->stamps[base + way] = c->clock;
+			}
+			c->dirty[base + way] |= write;
+			return;
+		}
+	}
+
+	c->total.misses++;
+	stats->misses++;
+
+	/*
+	 * Pick an invalid way first, otherwise ask the policy.
+	 */
+	victim = 0;
+	for (way = 0; way < c->ways; way++) {
+		if (!c->valid[base + way]) {
+			victim = way;
+			break;
+		}
+		if (c->stamps[base + way] < c->stamps[base + victim]) {
+			victim = way;
+		}
+	}
+	if (way >= c->ways && c->policy == POLICY_RANDOM) {
+		victim = rand_r(&c->seed) % c->ways;
+	}
+
+	if (c->valid[base + victim] && c->dirty[base + victim]) {
+		c->total.writeBacks++;
+		stats->writeBacks++;
+	}
+
+	c->tags[base + victim] = tag;
+	c->valid[base + victim] = 1;
+	c->dirty[base + victim] = write;
+	c->stamps[base + victim] = c->clock;
+}
+
+void cacheAccess(int which, uint32_t address, uint32_t size, int write)
+{
+	Cache *c = &caches[which];
+	CacheStats *stats;
+	uint32_t first, last;
+
+	if (!c->enabled) {
+		return;
+	}
+	stats = &functionStats[which][currentFunction];
+
+	first = address >> c->lineShift;
+	last = (address + size - 1) >> c->lineShift;
+
+	accessLine(c, stats, first, write);
+	if (last != first) {
+		accessLine(c, stats, last, write);
+	}
+}
+
+static uint64_t stallCycles(int which, CacheStats *stats)
+{
+	return (stats->misses + stats->writeBacks) * caches[which].missPenalty;
+}
+
+void cacheReport(FILE *stream)
+{
+	int which, i;
+
+	fprintf(stream, "\nCache simulation:\n");
+	for (which = 0; which < 2; which++) {
+		Cache *c = &caches[which];
+
+		if (!c->enabled) {
+			continue;
+		}
+		fprintf(stream, "%s %" PRIu32 "B %" PRIu32 "-way %" PRIu32 "B lines %s, "
+		        "%" PRIu32 " clock miss penalty\n",
+		        cacheNames[which], c->size, c->ways, c->lineSize,
+		        policyNames[c->policy], c->missPenalty);
+		fprintf(stream, "    %" PRIu64 " accesses, %" PRIu64 " misses (%.2f%% hit), "
+		        "%" PRIu64 " write backs, %" PRIu64 " stall cycles\n",
+		        c->total.accesses, c->total.misses,
+		        c->total.accesses == 0 ? 0.0 :
+		        100.0 * (c->total.accesses - c->total.misses) / c->total.accesses,
+		        c->total.writeBacks, stallCycles(which, &c->total));
+	}
+
+	fprintf(stream, "\n%-20s %12s %10s %12s %10s %12s\n", "function",
+	        "I-accesses", "I-misses", "D-accesses", "D-misses", "stalls");
+	for (i = 0; i <= numFunctions; i++) {
+		CacheStats none = {0, 0, 0};
+		CacheStats *inst = caches[CACHE_INST].enabled ? &functionStats[CACHE_INST][i] : &none;
+		CacheStats *data = caches[CACHE_DATA].enabled ? &functionStats[CACHE_DATA][i] : &none;
+
+		if (inst->accesses == 0 && data->accesses == 0) {
+			continue;
+		}
+		fprintf(stream, "%-20s %12" PRIu64 " %10" PRIu64 " %12" PRIu64 " %10" PRIu64 " %12" PRIu64 "\n",
+		        i == numFunctions ? "(unknown)" : symbolsName(i),
+		        inst->accesses, inst->misses, data->accesses, data->misses,
+		        stallCycles(CACHE_INST, inst) + stallCycles(CACHE_DATA, data));
+	}
+}
+
+void cacheFree()
+{
+	int which;
+
+	for (which = 0; which < 2; which++) {
+		Cache *c = &caches[which];
+
+		free(c->tags);
+		free(c->valid);
+		free(c->dirty);
+		free(c->stamps);
+		free(functionStats[which]);
+		memset(c, 0, sizeof(*c));
+		functionStats[which] = NULL;
+	}
+}
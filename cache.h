@@ -0,0 +1,46 @@
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include <stdio.h>
+#include <inttypes.h>
+
+#define CACHE_INST 0
+#define CACHE_DATA 1
+
+/*
+ * Configure the instruction or data cache from a string of the form
+ *
+ *     <size>:<ways>:<lineSize>[:<policy>[:<missPenalty>]]
+ *
+ * where policy is lru, fifo or random and missPenalty is the number of
+ * clock cycles a miss (or a dirty line write back) stalls the CPU. The
+ * penalty defaults to filling the line one BRAM byte per state, i.e.
+ * 2 * lineSize clocks. The data cache is write-back and write-allocate.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int cacheInit(int which, char *config);
+
+/*
+ * Attribute the following accesses to the function containing 'pc'.
+ */
+void cacheSetPC(uint32_t pc);
+
+/*
+ * Simulate an access of 'size' bytes starting at 'address'.
+ */
+void cacheAccess(int which, uint32_t address, uint32_t size, int write);
+
+/*
+ * Print hit and miss rates and the estimated stall cycles, in total and
+ * per .sym function.
+ */
+void cacheReport(FILE *stream);
+
+/*
+ * Release the simulated caches.
+ */
+void cacheFree();
+
+#endif /* __CACHE_H */
@@ -0,0 +1,382 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include "condition.h"
+#include "symbols.h"
+
+enum opcode {
+	OP_CONST,   // push the next word
+	OP_REG,     // push register named by the next word
+	OP_PC,
+	OP_HITS,
+	OP_WORD,    // replace address with the word there
+	OP_BYTE,    // replace address with the byte there
+	OP_NEG,
+	OP_NOT,
+	OP_LNOT,
+	OP_MUL,
+	OP_DIV,
+	OP_MOD,
+	OP_ADD,
+	OP_SUB,
+	OP_SHL,
+	OP_SHR,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+	OP_EQ,
+	OP_NE,
+	OP_AND,
+	OP_XOR,
+	OP_OR,
+	OP_LAND,
+	OP_LOR,
+};
+
+#define MAX_CODE  256
+#define MAX_STACK 32
+
+struct condition {
+	uint32_t code[MAX_CODE];
+	int length;
+};
+
+/*
+ * Recursive descent parser state. Each level emits its operands before
+ * its operator, which gives postfix code. 'depth' tracks the stack
+ * depth the code reaches.
+ */
+struct parser {
+	const char *p;
+	struct condition *c;
+	int depth;
+	int maxDepth;
+	char *error;
+	int errorSize;
+	int failed;
+};
+
+struct binaryOperator {
+	const char *token;
+	enum opcode op;
+};
+
+/*
+ * Binary operators by precedence level, lowest first. Longer tokens
+ * come before their prefixes.
+ */
+static struct binaryOperator levels[][4] = {
+	{{"||", OP_LOR}},
+	{{"&&", OP_LAND}},
+	{{"|", OP_OR}},
+	{{"^", OP_XOR}},
+	{{"&", OP_AND}},
+	{{"==", OP_EQ}, {"!=", OP_NE}},
+	{{"<=", OP_LE}, {">=", OP_GE}, {"<", OP_LT}, {">", OP_GT}},
+	{{"<<", OP_SHL}, {">>", OP_SHR}},
+	{{"+", OP_ADD}, {"-", OP_SUB}},
+	{{"*", OP_MUL}, {"/", OP_DIV}, {"%", OP_MOD}},
+};
+
+#define NUM_LEVELS (sizeof(levels) / sizeof(*levels))
+
+static void fail(struct parser *ps, const char *message)
+{
+	if (!ps->failed) {
+		snprintf(ps->error, ps->errorSize, "%s at '%s'", message, ps->p);
+		ps->failed = 1;
+	}
+}
+
+static void emit(struct parser *ps, uint32_t word, int stackChange)
+{
+	if (ps->c->length == MAX_CODE) {
+		fail(ps, "Condition too long");
+		return;
+	}
+	ps->c->code[ps->c->length++] = word;
+
+	ps->depth += stackChange;
+	if (ps->depth > ps->maxDepth) {
+		ps->maxDepth = ps->depth;
+	}
+}
+
+static void skipSpace(struct parser *ps)
+{
+	while (isspace((unsigned char)*ps->p)) {
+		ps->p++;
+	}
+}
+
+static int accept(struct parser *ps, const char *token)
+{
+	skipSpace(ps);
+	if (strncmp(ps->p, token, strlen(token)) != 0) {
+		return 0;
+	}
+
+	/*
+	 * Don't take '|' out of '||', '&' out of '&&' or '<' out of '<<'.
+	 */
+	if ((strlen(token) == 1) && (strchr("|&<>", token[0]) != NULL) &&
+		(ps->p[1] == token[0] || ps->p[1] == '=')) {
+		return 0;
+	}
+	ps->p += strlen(token);
+	return 1;
+}
+
+static int registerNumber(const char *name)
+{
+	static const char *names[] = {"sp", "ba", "fl", "c1", "c2"};
+	int i;
+
+	if (name[0] == 'r' && isdigit((unsigned char)name[1])) {
+		i = atoi(name + 1);
+		return i < NUM_REGISTERS ? i : -1;
+	}
+	for (i = 0; i < sizeof(names) / sizeof(*names); i++) {
+		if (strcmp(name, names[i]) == 0) {
+			return R_SP + i;
+		}
+	}
+	return -1;
+}
+
+static void expression(struct parser *ps, int level);
+
+static void primary(struct parser *ps)
+{
+	char name[256];
+	uint32_t value;
+	char *end;
+	int n = 0;
+
+	skipSpace(ps);
+
+	if (accept(ps, "(")) {
+		expression(ps, 0);
+		if (!accept(ps, ")")) {
+			fail(ps, "Expected ')'");
+		}
+		return;
+	}
+
+	if (accept(ps, "[")) {
+		expression(ps, 0);
+		emit(ps, OP_WORD, 0);
+		if (!accept(ps, "]")) {
+			fail(ps, "Expected ']'");
+		}
+		return;
+	}
+
+	if (ps->p[0] == 'b' && ps->p[1] == '[') {
+		ps->p++;
+		accept(ps, "[");
+		expression(ps, 0);
+		emit(ps, OP_BYTE, 0);
+		if (!accept(ps, "]")) {
+			fail(ps, "Expected ']'");
+		}
+		return;
+	}
+
+	if (isdigit((unsigned char)*ps->p)) {
+		value = strtoul(ps->p, &end, 0);
+		ps->p = end;
+		emit(ps, OP_CONST, 1);
+		emit(ps, value, 0);
+		return;
+	}
+
+	while ((isalnum((unsigned char)ps->p[n]) || ps->p[n] == '_' || ps->p[n] == '.') &&
+	       n < sizeof(name) - 1) {
+		name[n] = ps->p[n];
+		n++;
+	}
+	name[n] = '\0';
+	if (n == 0) {
+		fail(ps, "Expected a value");
+		return;
+	}
+
+	if (name[0] == '.') {
+		if (symbolsLookupName(name, &value) < 0) {
+			fail(ps, "Unknown label");
+			return;
+		}
+		emit(ps, OP_CONST, 1);
+		emit(ps, value, 0);
+	} else if (strcmp(name, "pc") == 0) {
+		emit(ps, OP_PC, 1);
+	} else if (strcmp(name, "hits") == 0) {
+		emit(ps, OP_HITS, 1);
+	} else if (registerNumber(name) >= 0) {
+		emit(ps, OP_REG, 1);
+		emit(ps, registerNumber(name), 0);
+	} else {
+		fail(ps, "Unknown name");
+		return;
+	}
+	ps->p += n;
+}
+
+static void unary(struct parser *ps)
+{
+	if (accept(ps, "-")) {
+		unary(ps);
+		emit(ps, OP_NEG, 0);
+	} else if (accept(ps, "~")) {
+		unary(ps);
+		emit(ps, OP_NOT, 0);
+	} else if (accept(ps, "!")) {
+		unary(ps);
+		emit(ps, OP_LNOT, 0);
+	} else {
+		primary(ps);
+	}
+}
+
+static void expression(struct parser *ps, int level)
+{
+	int i, matched;
+
+	if (level == NUM_LEVELS) {
+		unary(ps);
+		return;
+	}
+
+	expression(ps, level + 1);
+	do {
+		matched = 0;
+		for (i = 0; i < 4 && levels[level][i].token != NULL; i++) {
+			if (accept(ps, levels[level][i].token)) {
+				expression(ps, level + 1);
+				emit(ps, levels[level][i].op, -1);
+				matched = 1;
+				break;
+			}
+		}
+	} while (matched && !ps->failed);
+}
+
+struct condition *conditionCompile(const char *text, char *error, int errorSize)
+{
+	struct parser ps;
+
+	memset(&ps, 0, sizeof(ps));
+	ps.p = text;
+	ps.error = error;
+	ps.errorSize = errorSize;
+
+	if ((ps.c = calloc(1, sizeof(*ps.c))) == NULL) {
+		snprintf(error, errorSize, "Can't allocate condition");
+		return NULL;
+	}
+
+	expression(&ps, 0);
+	skipSpace(&ps);
+	if (*ps.p != '\0') {
+		fail(&ps, "Unexpected text");
+	}
+	if (ps.maxDepth > MAX_STACK) {
+		fail(&ps, "Condition too deep");
+	}
+	if (ps.failed) {
+		free(ps.c);
+		return NULL;
+	}
+
+	return ps.c;
+}
+
+static uint32_t peek(struct cpuState *cpu, uint32_t address, int size)
+{
+	uint32_t value = 0;
+	int i;
+
+	if ((uint64_t)address + size > cpu->memSize) {
+		return 0;
+	}
+	for (i = size - 1; i >= 0; i--) {
+		value = (value << 8) | cpu->mem[address + i];
+	}
+	return value;
+}
+
+uint32_t conditionEval(struct condition *c, struct cpuState *cpu, uint64_t hits)
+{
+	uint32_t stack[MAX_STACK];
+	uint32_t a, b;
+	int sp = 0;
+	int i;
+
+	for (i = 0; i < c->length; i++) {
+		switch (c->code[i]) {
+			case OP_CONST:
+				stack[sp++] = c->code[++i];
+				continue;
+			case OP_REG:
+				stack[sp++] = cpu->r[c->code[++i]];
+				continue;
+			case OP_PC:
+				stack[sp++] = cpu->pc;
+				continue;
+			case OP_HITS:
+				stack[sp++] = hits > UINT32_MAX ? UINT32_MAX : hits;
+				continue;
+			case OP_WORD:
+				stack[sp - 1] = peek(cpu, stack[sp - 1], 4);
+				continue;
+			case OP_BYTE:
+				stack[sp - 1] = peek(cpu, stack[sp - 1], 1);
+				continue;
+			case OP_NEG:
+				stack[sp - 1] = -stack[sp - 1];
+				continue;
+			case OP_NOT:
+				stack[sp - 1] = ~stack[sp - 1];
+				continue;
+			case OP_LNOT:
+				stack[sp - 1] = !stack[sp - 1];
+				continue;
+		}
+
+		b = stack[--sp];
+		a = stack[sp - 1];
+		switch (c->code[i]) {
+			case OP_MUL:  a = a * b; break;
+			case OP_DIV:  a = b != 0 ? a / b : 0; break;
+			case OP_MOD:  a = b != 0 ? a % b : 0; break;
+			case OP_ADD:  a = a + b; break;
+			case OP_SUB:  a = a - b; break;
+			case OP_SHL:  a = b < 32 ? a << b : 0; break;
+			case OP_SHR:  a = b < 32 ? a >> b : 0; break;
+			case OP_LT:   a = a < b; break;
+			case OP_LE:   a = a <= b; break;
+			case OP_GT:   a = a > b; break;
+			case OP_GE:   a = a >= b; break;
+			case OP_EQ:   a = a == b; break;
+			case OP_NE:   a = a != b; break;
+			case OP_AND:  a = a & b; break;
+			case OP_XOR:  a = a ^ b; break;
+			case OP_OR:   a = a | b; break;
+			case OP_LAND: a = a && b; break;
+			case OP_LOR:  a = a || b; break;
+		}
+		stack[sp - 1] = a;
+	}
+
+	return sp > 0 ? stack[sp - 1] : 0;
+}
+
+void conditionFree(struct condition *c)
+{
+	free(c);
+}
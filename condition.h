@@ -0,0 +1,38 @@
+#ifndef __CONDITION_H
+#define __CONDITION_H
+
+#include <inttypes.h>
+
+#include "cpu.h"
+
+/*
+ * Breakpoint conditions. An expression like
+ *
+ *   r0 > 0x1000 && [sp] != .malloc
+ *
+ * is compiled once into a small stack machine program, so that checking
+ * it on a hit is a short loop with no parsing.
+ *
+ * Operands are numbers, registers (r0 to r15, sp, ba, fl, c1, c2, pc),
+ * labels (.name), 'hits' (times the breakpoint was reached, this one
+ * included), [expr] for the little endian word and b[expr] for the byte
+ * at guest address expr. Operators are those of C with the same
+ * precedence: unary - ~ !, * / %, + -, << >>, < <= > >=, == !=, &, ^,
+ * |, && and ||. Comparisons are unsigned and all values are 32 bit.
+ */
+struct condition;
+
+/*
+ * Compile 'text'. On error, returns NULL with a message in 'error'.
+ */
+struct condition *conditionCompile(const char *text, char *error, int errorSize);
+
+/*
+ * Evaluate 'c' on the current state. Memory outside guest memory reads
+ * as 0 and memory mapped registers aren't touched.
+ */
+uint32_t conditionEval(struct condition *c, struct cpuState *cpu, uint64_t hits);
+
+void conditionFree(struct condition *c);
+
+#endif /* __CONDITION_H */
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include "console.h"
+
+static struct cpuState *consoleCPU;
+
+static uint32_t control;
+
+static int outputFd = -1;
+static int outputTerminal;
+static char outputBuffer[CONSOLE_BUFFER];
+static uint32_t outputLength;
+
+/*
+ * Received bytes wait in 'fifo' from 'fifoHead' up to 'fifoTail'.
+ */
+static int inputFd = -1;
+static int inputEnded;
+static uint8_t fifo[CONSOLE_FIFO];
+static uint32_t fifoHead;
+static uint32_t fifoTail;
+static uint32_t pollCountdown;
+
+void consoleInit(struct cpuState *cpu)
+{
+	consoleCPU = cpu;
+}
+
+static int openFile(char *path, int flags, int standardFd)
+{
+	int fd;
+
+	if (strcmp(path, "-") == 0) {
+		return standardFd;
+	}
+	if ((fd = open(path, flags, 0644)) < 0) {
+		fprintf(stderr, "Can't open console file '%s': %s\n", path, strerror(errno));
+	}
+	return fd;
+}
+
+int consoleOpen(char *config)
+{
+	char *output = strdup(config != NULL ? config : "-");
+	char *input;
+	int ret = -1;
+
+	if ((input = strchr(output, ',')) != NULL) {
+		*input++ = '\0';
+	}
+
+	if ((outputFd = openFile(*output != '\0' ? output : "-",
+	                         O_WRONLY | O_CREAT | O_TRUNC, STDOUT_FILENO)) < 0) {
+		goto DONE;
+	}
+	outputTerminal = isatty(outputFd);
+
+	if ((input != NULL) &&
+		((inputFd = openFile(input, O_RDONLY, STDIN_FILENO)) < 0)) {
+		goto DONE;
+	}
+	ret = 0;
+
+DONE:
+	free(output);
+	return ret;
+}
+
+int consoleUsesTerminal()
+{
+	return outputFd == STDOUT_FILENO || inputFd == STDIN_FILENO;
+}
+
+static void flush()
+{
+	uint32_t done = 0;
+	ssize_t n;
+
+	/*
+	 * Keep the order with the emulator's own messages on stdout.
+	 */
+	if (outputFd == STDOUT_FILENO) {
+		fflush(stdout);
+	}
+
+	while (done < outputLength) {
+		if ((n = write(outputFd, outputBuffer + done, outputLength - done)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "Can't write console output: %s\n", strerror(errno));
+			break;
+		}
+		done += n;
+	}
+	outputLength = 0;
+}
+
+void consoleClose()
+{
+	if (outputFd >= 0) {
+		flush();
+		if (outputFd != STDOUT_FILENO) {
+			close(outputFd);
+		}
+		outputFd = -1;
+	}
+	if (inputFd >= 0) {
+		if (inputFd != STDIN_FILENO) {
+			close(inputFd);
+		}
+		inputFd = -1;
+	}
+}
+
+static void transmit(uint8_t c)
+{
+	if (outputFd < 0) {
+		return;
+	}
+
+	outputBuffer[outputLength++] = c;
+	if ((outputLength == CONSOLE_BUFFER) || (outputTerminal && c == '\n')) {
+		flush();
+	}
+}
+
+/*
+ * Move whatever input is ready into the FIFO without blocking. Only
+ * called with the FIFO empty, so it always refills from the start.
+ */
+static void receive()
+{
+	struct pollfd p = {inputFd, POLLIN, 0};
+	ssize_t n;
+
+	if (inputFd < 0 || inputEnded || poll(&p, 1, 0) <= 0) {
+		return;
+	}
+
+	/*
+	 * Someone typing at a prompt wants to see it first.
+	 */
+	if (outputLength != 0) {
+		flush();
+	}
+
+	if ((n = read(inputFd, fifo, CONSOLE_FIFO)) <= 0) {
+		inputEnded = 1;
+		return;
+	}
+	fifoHead = 0;
+	fifoTail = n;
+
+	if (control & CONSOLE_RX_INT) {
+		consoleCPU->intPending |= 1 << INT_CONSOLE;
+	}
+}
+
+uint32_t consoleRead(uint32_t offset)
+{
+	uint32_t status = CONSOLE_TX_READY;
+
+	switch (offset & ~0x3) {
+		case CONSOLE_DATA:
+			/*
+			 * Only the low byte pops the FIFO, the others read as 0.
+			 */
+			if (offset != CONSOLE_DATA) {
+				return 0;
+			}
+			if (fifoHead == fifoTail) {
+				receive();
+			}
+			return fifoHead != fifoTail ? fifo[fifoHead++] : 0;
+		case CONSOLE_STATUS:
+			if (fifoHead == fifoTail) {
+				receive();
+			}
+			if (fifoHead != fifoTail) {
+				status |= CONSOLE_RX_READY;
+			} else if (inputEnded || inputFd < 0) {
+				status |= CONSOLE_RX_EOF;
+			}
+			return status;
+		default:
+			return control;
+	}
+}
+
+void consoleWrite(uint32_t offset, uint32_t data)
+{
+	switch (offset & ~0x3) {
+		case CONSOLE_DATA:
+			transmit(data & 0xFF);
+			break;
+		case CONSOLE_CONTROL:
+			if (data & CONSOLE_FLUSH) {
+				flush();
+			}
+			control = data & CONSOLE_RX_INT;
+			break;
+	}
+}
+
+int consoleBusy()
+{
+	return (control & CONSOLE_RX_INT) && inputFd >= 0 && !inputEnded &&
+	       fifoHead == fifoTail;
+}
+
+void consoleTick()
+{
+	if (pollCountdown-- == 0) {
+		pollCountdown = CONSOLE_POLL;
+		receive();
+	}
+}
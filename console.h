@@ -0,0 +1,82 @@
+#ifndef __CONSOLE_H
+#define __CONSOLE_H
+
+#include "cpu.h"
+
+/*
+ * Console (UART) registers, relative to the memory mapped I/O region.
+ *
+ * Writing Data sends its low byte, reading it returns the next received
+ * byte (0 if none). Output is buffered on the host and written out in
+ * batches. Status has CONSOLE_RX_READY set while received bytes are
+ * waiting, CONSOLE_TX_READY is always set and CONSOLE_RX_EOF is set once
+ * the input has ended. With CONSOLE_RX_INT set in Control, the
+ * INT_CONSOLE interrupt becomes pending when bytes arrive. Writing
+ * CONSOLE_FLUSH to Control writes out buffered output right away.
+ */
+#define CONSOLE_BASE      0xD4
+#define CONSOLE_SIZE      0xC
+
+#define CONSOLE_DATA      0x0
+#define CONSOLE_STATUS    0x4
+#define CONSOLE_CONTROL   0x8
+
+#define CONSOLE_RX_READY  0x1
+#define CONSOLE_TX_READY  0x2
+#define CONSOLE_RX_EOF    0x4
+
+#define CONSOLE_RX_INT    0x1
+#define CONSOLE_FLUSH     0x2
+
+/*
+ * Host side buffer sizes in bytes.
+ */
+#define CONSOLE_BUFFER    4096
+#define CONSOLE_FIFO      256
+
+/*
+ * Instructions between checks for input while the guest waits for the
+ * receive interrupt.
+ */
+#define CONSOLE_POLL      1024
+
+void consoleInit(struct cpuState *cpu);
+
+/*
+ * Connect the console as [<outputPath>][,<inputPath>], where - is
+ * stdout or stdin. 'config' may be NULL for output to stdout only.
+ * Output to a terminal is also flushed at the end of every line.
+ *
+ * Without a call to consoleOpen() output is dropped and there is no
+ * input.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int consoleOpen(char *config);
+
+/*
+ * Returns 1 if output or input is stdout or stdin.
+ */
+int consoleUsesTerminal();
+
+/*
+ * Flush buffered output and close the files.
+ */
+void consoleClose();
+
+uint32_t consoleRead(uint32_t offset);
+void consoleWrite(uint32_t offset, uint32_t data);
+
+/*
+ * Returns 1 while the guest waits for the receive interrupt.
+ */
+int consoleBusy();
+
+/*
+ * Check for input now and then. Called once per instruction while
+ * busy.
+ */
+void consoleTick();
+
+#endif /* __CONSOLE_H */
@@ -0,0 +1,299 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <errno.h>
+
+#include "coverage.h"
+
+static struct option longopts[] = {
+	{"coverage", required_argument, NULL, 'c'},
+	{"binary", required_argument, NULL, 'b'},
+	{"lines", no_argument, NULL, 'l'},
+	{"help", no_argument, NULL, 'h'},
+	{NULL, 0, NULL, 0}
+};
+
+char *optdesc[] = {
+	"Coverage file written by the emulator (may be repeated to merge runs).",
+	"A binary that was loaded as <binaryPath>:<memoryOffset>.",
+	"Annotate every source line with its coverage.",
+	"This help."
+};
+
+char *optstring = NULL;
+
+struct binary {
+	char *filePath;
+	uint32_t memoryOffset;
+	struct binary *next;
+};
+
+static struct binary *gBinaryList;
+static int cmdLines;
+
+static uint8_t *coverage;
+static uint32_t memSize;
+
+void usage(int argc, char **argv)
+{
+	int i;
+	int numOptions;
+	int longest;
+
+	printf("%s [OPTION...]\n\n", argv[0]);
+
+	numOptions = sizeof(longopts) / sizeof(*longopts) - 1;
+	longest = 0;
+	for (i = 0; i < numOptions; ++i) {
+		if (longest < strlen(longopts[i].name)) {
+			longest = strlen(longopts[i].name);
+		}
+	}
+	for (i = 0; i < numOptions; ++i) {
+		printf("--%-*s, -%c : %s\n", longest, longopts[i].name, longopts[i].val, optdesc[i]);
+	}
+	printf("\n");
+}
+
+/*
+ * Read a coverage file and merge it into the global bitmap.
+ */
+static int loadCoverage(char *path)
+{
+	FILE *f;
+	struct coverageHeader header;
+	uint8_t *map;
+	uint32_t i, n;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		fprintf(stderr, "Can't open %s: %s\n", path, strerror(errno));
+		return(-1);
+	}
+
+	if ((fread(&header, sizeof(header), 1, f) != 1) ||
+		(header.magic != COVERAGE_MAGIC)) {
+		fprintf(stderr, "%s is not a coverage file.\n", path);
+		fclose(f);
+		return(-1);
+	}
+
+	if (coverage != NULL && header.memSize != memSize) {
+		fprintf(stderr, "%s has a different memory size.\n", path);
+		fclose(f);
+		return(-1);
+	}
+
+	n = coverageBytes(header.memSize);
+	if ((map = malloc(n)) == NULL) {
+		fprintf(stderr, "Can't allocate coverage map: %s\n", strerror(errno));
+		fclose(f);
+		return(-1);
+	}
+	if (fread(map, 1, n, f) != n) {
+		fprintf(stderr, "%s is truncated.\n", path);
+		free(map);
+		fclose(f);
+		return(-1);
+	}
+	fclose(f);
+
+	if (coverage == NULL) {
+		coverage = map;
+		memSize = header.memSize;
+		return(0);
+	}
+
+	for (i = 0; i < n; i++) {
+		coverage[i] |= map[i];
+	}
+	free(map);
+
+	return(0);
+}
+
+static int addBinary(char *binaryInfo)
+{
+	struct binary *newBinary;
+	char *separator;
+
+	if (((separator = strrchr(binaryInfo, ':')) == NULL) ||
+		(separator == binaryInfo) || (strlen(separator) <= 1)) {
+		fprintf(stderr, "Expected binaryInfo as <filePath>:<memoryOffset>\n");
+		return -1;
+	}
+	separator[0] = '\0';
+
+	newBinary = malloc(sizeof(*newBinary));
+	newBinary->filePath = strdup(binaryInfo);
+	newBinary->memoryOffset = strtoull(separator + 1, NULL, 0);
+
+	newBinary->next = gBinaryList;
+	gBinaryList = newBinary;
+
+	return 0;
+}
+
+void parseArgs(int argc, char **argv)
+{
+	int c, i;
+	int longindex;
+	int numOptions;
+
+	numOptions = sizeof(longopts) / sizeof(*longopts) - 1;
+	optstring = malloc(numOptions * 3);
+	memset(optstring, 0, numOptions * 3);
+
+	c = 0;
+	for (i = 0; i < numOptions; ++i) {
+		c += sprintf(optstring+c, "%c%s", (char)longopts[i].val,
+					 longopts[i].has_arg == no_argument ? "" :
+					 longopts[i].has_arg == required_argument ? ":" :
+					 "::");
+	}
+
+	while ((c = getopt_long(argc, argv, optstring, longopts, &longindex)) >= 0) {
+		switch (c) {
+			case 'c':
+				if (loadCoverage(optarg) < 0) {
+					exit(1);
+				}
+				break;
+			case 'b':
+				if (addBinary(optarg) < 0) {
+					exit(1);
+				}
+				break;
+			case 'l':
+				cmdLines = 1;
+				break;
+			case 'h':
+				usage(argc, argv);
+				break;
+			case '?':
+				break;
+			default:
+				exit(1);
+		}
+	}
+
+	if (coverage == NULL || gBinaryList == NULL) {
+		fprintf(stderr, "Expected a coverage file and a binary.\n");
+		exit(1);
+	}
+
+	free(optstring);
+}
+
+#define LINE_NONE     0
+#define LINE_MISSED   1
+#define LINE_COVERED  2
+
+/*
+ * Join the coverage bitmap with the binary's *.debug line table and
+ * report the covered and uncovered lines of its *.asm source.
+ */
+static int reportBinary(struct binary *binary)
+{
+	char *sourceFile, *debugFile;
+	char *marker;
+	FILE *f;
+	int len;
+	int lineNum;
+	unsigned int progOffset;
+	int maxLine = 0;
+	int total = 0, covered = 0;
+	uint8_t *state = NULL;
+
+	if ((marker = strrchr(binary->filePath, '.')) == NULL) {
+		fprintf(stderr, "Can't find file extension.\n");
+		return(-1);
+	}
+	len = (uintptr_t)marker - (uintptr_t)binary->filePath;
+	asprintf(&sourceFile, "%.*s.asm", len, binary->filePath);
+	asprintf(&debugFile, "%.*s.debug", len, binary->filePath);
+
+	if ((f = fopen(debugFile, "r")) == NULL) {
+		fprintf(stderr, "Can't open '%s': %s\n", debugFile, strerror(errno));
+		goto ERROR;
+	}
+
+	while (fscanf(f, "%d %X", &lineNum, &progOffset) == 2) {
+		uint32_t pc = binary->memoryOffset + progOffset;
+
+		if (lineNum >= maxLine) {
+			int n = lineNum + 1024;
+
+			if ((state = realloc(state, n)) == NULL) {
+				fprintf(stderr, "Can't allocate line table: %s\n", strerror(errno));
+				fclose(f);
+				goto ERROR;
+			}
+			memset(state + maxLine, LINE_NONE, n - maxLine);
+			maxLine = n;
+		}
+
+		total++;
+		if (pc < memSize && coverageTest(coverage, pc)) {
+			covered++;
+			state[lineNum] = LINE_COVERED;
+		} else {
+			state[lineNum] = LINE_MISSED;
+		}
+	}
+	fclose(f);
+
+	printf("%s: %d of %d instructions executed (%.1f%%)\n", sourceFile,
+	       covered, total, total == 0 ? 0.0 : 100.0 * covered / total);
+
+	if (cmdLines) {
+		char *line = NULL;
+		size_t lineSize = 0;
+
+		if ((f = fopen(sourceFile, "r")) == NULL) {
+			fprintf(stderr, "Can't open '%s': %s\n", sourceFile, strerror(errno));
+			goto ERROR;
+		}
+
+		for (lineNum = 1; getline(&line, &lineSize, f) >= 0; lineNum++) {
+			int s = lineNum < maxLine ? state[lineNum] : LINE_NONE;
+
+			printf("%6s %5d: %s",
+			       s == LINE_COVERED ? "+" : s == LINE_MISSED ? "#####" : "",
+			       lineNum, line);
+		}
+		free(line);
+		fclose(f);
+		printf("\n");
+	}
+
+	free(state);
+	free(sourceFile);
+	free(debugFile);
+	return(0);
+
+ERROR:
+	free(state);
+	free(sourceFile);
+	free(debugFile);
+	return(-1);
+}
+
+int main(int argc, char **argv)
+{
+	struct binary *binary;
+	int returnValue = 0;
+
+	parseArgs(argc, argv);
+
+	for (binary = gBinaryList; binary != NULL; binary = binary->next) {
+		if (reportBinary(binary) < 0) {
+			returnValue = 1;
+		}
+	}
+
+	return(returnValue);
+}
@@ -0,0 +1,28 @@
+#ifndef __COVERAGE_H
+#define __COVERAGE_H
+
+#include <inttypes.h>
+
+/*
+ * Coverage file written by `emulator --coverage` and read by `coverage`.
+ *
+ * The header is followed by a bitmap with one bit per 8 byte instruction
+ * slot of guest memory. A set bit means the instruction at that slot was
+ * executed at least once.
+ */
+#define COVERAGE_MAGIC 0xC0DEC0FE
+
+struct coverageHeader {
+	uint32_t magic;
+	uint32_t memSize;
+};
+
+#define coverageBytes(memSize) (((memSize) >> 6) + 1)
+
+#define coverageMark(map, pc) \
+	((map)[(pc) >> 6] |= (uint8_t)(1 << (((pc) >> 3) & 7)))
+
+#define coverageTest(map, pc) \
+	(((map)[(pc) >> 6] >> (((pc) >> 3) & 7)) & 1)
+
+#endif /* __COVERAGE_H */
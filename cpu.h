@@ -21,6 +21,30 @@
 
 #define NUM_REGISTERS 16
 
+/*
+ * Interrupts:
+ *
+ * Bit 0 of the Global Interrupt Control register enables interrupts.
+ * Each interrupt has a bit in the Pending and Per-Interrupt Control
+ * registers and an entry in the Interrupt Handler Vector.
+ */
+#define INT_GLOBAL_ENABLE 0x1
+
+#define INT_TIMER1  0
+#define INT_TIMER2  1
+#define INT_DMA     2
+#define INT_BLOCK   3
+#define INT_CONSOLE 4
+#define INT_SPI     5
+
+/*
+ * Bit 0 of a Timer Control register enables the timer.
+ */
+#define TIMER_ENABLE 0x1
+
+#define MMAP_IO_START 0x2000
+#define MMAP_IO_SIZE  0xEC
+
 struct cpuState {
 	/*
 	 * Memory Mapped I/O:
@@ -70,6 +94,21 @@ struct cpuState {
 	char		msg[4096];
 };
 
+/*
+ * Returns 1 if [address, address + size) is plain memory, 0 if it runs
+ * past the end of memory or reaches memory mapped I/O. Devices and hooks
+ * check guest buffers with it before touching cpu->mem directly.
+ */
+static inline int isMemory(struct cpuState *cpu, uint32_t address, uint64_t size)
+{
+	uint64_t end = (uint64_t)address + size;
+
+	if (end > cpu->memSize) {
+		return 0;
+	}
+	return (end <= cpu->mmapIOstart) || (address >= cpu->mmapIOend);
+}
+
 /*
  * Temporary stores decoded instructions.
  */
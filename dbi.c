@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "dbi.h"
+
+/*
+ * Returns 1 if 'count' entries of 'size' bytes at 'offset' fit in the
+ * file.
+ */
+static int fits(uint64_t offset, uint64_t count, uint64_t size, uint64_t fileSize)
+{
+	return offset <= fileSize && count * size <= fileSize - offset;
+}
+
+static int valid(const struct dbiHeader *dbi, size_t size)
+{
+	const struct dbiSymbol *symbols;
+	const char *strings;
+	uint32_t i;
+
+	if ((size < sizeof(*dbi)) || (dbi->magic != DBI_MAGIC) || (dbi->version != DBI_VERSION)) {
+		return 0;
+	}
+	if (!fits(dbi->lines, dbi->lineCount, sizeof(struct dbiLine), size) ||
+		!fits(dbi->index, (uint64_t)dbi->maxLine + 1, sizeof(uint32_t), size) ||
+		!fits(dbi->symbols, dbi->symbolCount, sizeof(struct dbiSymbol), size) ||
+		!fits(dbi->strings, dbi->stringSize, 1, size) ||
+		(dbi->lines % 4) || (dbi->index % 4) || (dbi->symbols % 4)) {
+		return 0;
+	}
+
+	/*
+	 * Names are used in place, so each must end inside the string table.
+	 */
+	strings = (const char *)dbi + dbi->strings;
+	if ((dbi->stringSize == 0) || (strings[dbi->stringSize - 1] != '\0') ||
+		(dbi->source >= dbi->stringSize)) {
+		return 0;
+	}
+	symbols = dbiSymbols(dbi);
+	for (i = 0; i < dbi->symbolCount; i++) {
+		if (symbols[i].name >= dbi->stringSize) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+const struct dbiHeader *dbiMap(const char *fileName, size_t *size)
+{
+	struct stat statBuffer;
+	void *map;
+	int fd;
+
+	if (((fd = open(fileName, O_RDONLY)) < 0) ||
+		(fstat(fd, &statBuffer) < 0)) {
+		fprintf(stderr, "Can't open '%s': %s\n", fileName, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+
+	if (statBuffer.st_size < sizeof(struct dbiHeader)) {
+		fprintf(stderr, "'%s' is not debug info.\n", fileName);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, statBuffer.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "Can't map '%s': %s\n", fileName, strerror(errno));
+		return NULL;
+	}
+
+	if (!valid(map, statBuffer.st_size)) {
+		fprintf(stderr, "'%s' is not valid debug info.\n", fileName);
+		munmap(map, statBuffer.st_size);
+		return NULL;
+	}
+
+	*size = statBuffer.st_size;
+	return map;
+}
+
+void dbiUnmap(const struct dbiHeader *dbi, size_t size)
+{
+	if (dbi != NULL) {
+		munmap((void *)dbi, size);
+	}
+}
+
+const struct dbiLine *dbiLines(const struct dbiHeader *dbi)
+{
+	return (const struct dbiLine *)((const char *)dbi + dbi->lines);
+}
+
+const uint32_t *dbiIndex(const struct dbiHeader *dbi)
+{
+	return (const uint32_t *)((const char *)dbi + dbi->index);
+}
+
+const struct dbiSymbol *dbiSymbols(const struct dbiHeader *dbi)
+{
+	return (const struct dbiSymbol *)((const char *)dbi + dbi->symbols);
+}
+
+const char *dbiString(const struct dbiHeader *dbi, uint32_t offset)
+{
+	return (const char *)dbi + dbi->strings + offset;
+}
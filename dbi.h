@@ -0,0 +1,73 @@
+#ifndef __DBI_H
+#define __DBI_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+ * Binary debug info, as written by `assembler.py --debug-binary` next to
+ * the binary (foo.bin -> foo.dbi). It holds the .debug line table and
+ * the .sym exported labels in a form that is used in place once mapped.
+ *
+ * Every field is a little endian 32 bit word and every table is found
+ * through its byte offset from the start of the file:
+ *
+ *   header
+ *   lines    lineCount struct dbiLine, sorted by offset
+ *   index    maxLine + 1 offsets, the lowest one of each source line or
+ *            DBI_NONE for lines without code
+ *   symbols  symbolCount struct dbiSymbol, sorted by address
+ *   strings  NUL terminated names, the source file name first
+ *
+ * Line offsets are relative to the base address the program was
+ * assembled at, symbol addresses include it.
+ */
+#define DBI_MAGIC   0x31494244 // "DBI1"
+#define DBI_VERSION 1
+#define DBI_NONE    UINT32_MAX
+
+struct dbiHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t baseAddress;
+	uint32_t source;
+	uint32_t lineCount;
+	uint32_t lines;
+	uint32_t maxLine;
+	uint32_t index;
+	uint32_t symbolCount;
+	uint32_t symbols;
+	uint32_t stringSize;
+	uint32_t strings;
+};
+
+struct dbiLine {
+	uint32_t offset;
+	uint32_t line;
+};
+
+struct dbiSymbol {
+	uint32_t address;
+	uint32_t name;
+};
+
+/*
+ * Map 'fileName' read only and check that its tables and names are
+ * within the file.
+ *
+ * On success, returns the header and stores the mapping size in 'size'.
+ * On error, returns NULL.
+ */
+const struct dbiHeader *dbiMap(const char *fileName, size_t *size);
+
+void dbiUnmap(const struct dbiHeader *dbi, size_t size);
+
+/*
+ * Table accessors.
+ */
+const struct dbiLine *dbiLines(const struct dbiHeader *dbi);
+const uint32_t *dbiIndex(const struct dbiHeader *dbi);
+const struct dbiSymbol *dbiSymbols(const struct dbiHeader *dbi);
+const char *dbiString(const struct dbiHeader *dbi, uint32_t offset);
+
+#endif /* __DBI_H */
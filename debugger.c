@@ -10,8 +10,15 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <signal.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
 
 #include "debugger.h"
+#include "condition.h"
+#include "dbi.h"
+#include "reverse.h"
+#include "symbols.h"
 #include "isa.h"
 
 typedef struct DebugInfo
@@ -19,13 +26,27 @@ typedef struct DebugInfo
 	char *sourceFile;
 	char *debugFile;
 	char *binaryFile;
+	char *dbiFile;
 
+	/*
+	 * The source is read in one buffer, 'text' points at each line.
+	 */
+	char *textBuffer;
 	char **text;
 	int lineCount;
 
-	int *indexLine;
-	int *indexOffset;
-	int indexCount;
+	/*
+	 * Program offset to line: the .debug entries sorted by offset, for a
+	 * binary search. Line to program offset: the lowest offset of each
+	 * line, indexed by line number, DBI_NONE for lines without code.
+	 * Both point into 'dbi' when it is mapped.
+	 */
+	const struct dbiLine *entries;
+	int entryCount;
+	const uint32_t *lineOffset;
+	uint32_t maxLine;
+	const struct dbiHeader *dbi;
+	size_t dbiSize;
 
 	uint32_t binarySize;
 	uint32_t baseAddr;
@@ -51,6 +72,48 @@ static DebugInfo *gInfo;
 static int keepGoing;
 static int simpleTUI = 0;
 
+/*
+ * While continuing in the TUI, a UI thread redraws the code and registers
+ * windows at a fixed frame rate and pauses the program on a key press.
+ * It asks for both through uiRequest, which the emulator only looks at
+ * between instructions, so the registers it draws are a consistent
+ * snapshot. Curses calls from either thread hold screenLock.
+ */
+#define UI_FRAME_US 33333
+#define UI_SNAPSHOT 1
+#define UI_PAUSE    2
+
+static pthread_t uiThread;
+static int uiRunning;
+static int uiQuit;
+static int uiRequest;
+static pthread_mutex_t screenLock;
+static pthread_mutex_t snapshotLock = PTHREAD_MUTEX_INITIALIZER;
+static struct cpuState snapshot;
+static int snapshotReady;
+
+/*
+ * The memory window shows memLines lines of memWidth bytes, starting
+ * memScroll lines from the followed register or from memAddress. Each
+ * line is only redrawn when its address or bytes differ from what
+ * memShown says is on screen.
+ */
+#define MEM_FOLLOW_ADDRESS -1
+#define MEM_FOLLOW_PC      NUM_REGISTERS
+
+static int memFollow = R_SP;
+static uint32_t memAddress;
+static int memScroll;
+static int memWidth;
+static int memLines;
+static uint8_t *memShown;
+static uint32_t *memShownAddress;
+static int *memShownCount; // -1 while the line is not drawn.
+static uint32_t snapshotBase;
+static uint32_t snapshotCount;
+static uint8_t *snapshotMem;
+static uint8_t *uiMem;
+
 #define BP_PC 0
 #define BP_LINE 1
 #define BP_MEM_RD 2
@@ -61,9 +124,21 @@ static int simpleTUI = 0;
 struct breakpoint {
 	int type;
 	uint32_t condition; // Does this need to be 64 bit?
-	uint64_t maxHits;
 	uint64_t id;
 
+	/*
+	 * Every time the breakpoint is reached, 'hits' goes up and 'expr'
+	 * (compiled from 'exprText') is evaluated. Only when it holds does
+	 * the breakpoint count against 'ignore', and only once that is used
+	 * up does it stop the program. Temporary breakpoints are deleted
+	 * when they stop it.
+	 */
+	struct condition *expr;
+	char exprText[512];
+	uint64_t hits;
+	uint64_t ignore;
+	int temporary;
+
 	/*
 	 * Generic storage for breakpoint type agnostic arguments.
 	 */
@@ -72,6 +147,14 @@ struct breakpoint {
 	uint32_t num1;
 	uint32_t num2;
 
+	/*
+	 * Set by debuggerWatch() when the current instruction touches this
+	 * watchpoint, with the first address it touched and its PC.
+	 */
+	int watched;
+	uint32_t watchAddress;
+	uint32_t watchPC;
+
 	struct breakpoint *next;
 };
 
@@ -82,6 +165,28 @@ struct bptype {
 
 static struct breakpoint *bp_list;
 static uint64_t bp_list_count;
+
+/*
+ * PC and line breakpoints are also kept as one bit per address, in pages
+ * of BP_PAGE_SIZE addresses allocated as needed, so that checking the PC
+ * doesn't walk bp_list. Finish breakpoints depend on the instruction and
+ * are only counted.
+ */
+#define BP_PAGE_SHIFT 12
+#define BP_PAGE_SIZE (1 << BP_PAGE_SHIFT)
+
+static uint8_t **bp_pages;
+static uint32_t bp_page_count;
+static int bp_finish_count;
+
+/*
+ * Watchpoints mark the guest pages they cover in watchPages, which the
+ * emulator's memory helpers test before calling debuggerWatch(). Every
+ * watchpoint an instruction touches is flagged and counted in watch_hits
+ * until the debugger gets control back.
+ */
+uint8_t *watchPages;
+static int watch_hits;
 static struct bptype bp_table[] = {
 	{BP_PC, "pc"},
 	{BP_LINE, "line"},
@@ -95,25 +200,49 @@ static struct bptype bp_table[] = {
 
 static int shellPrint(const char *fmt, ...)
 {
-	wmove(shell->wn, shell->h - 1, 5);
-
 	va_list argPtr;
 	va_start(argPtr, fmt);
 	if (simpleTUI != 0) {
-		fprintf(stderr, fmt, argPtr);
+		vfprintf(stderr, fmt, argPtr);
 	} else {
+		pthread_mutex_lock(&screenLock);
+		wmove(shell->wn, shell->h - 1, 5);
 		vw_printw(shell->wn, fmt, argPtr);
 		wrefresh(shell->wn);
 		refresh();
+		pthread_mutex_unlock(&screenLock);
 	}
 	va_end(argPtr);
 
 	return 0;
 }
 
+/*
+ * Returns the line of the instruction at 'offset' in 'info' or -1.
+ */
+static int offsetToLine(DebugInfo *info, uint32_t offset)
+{
+	int low = 0;
+	int high = info->entryCount - 1;
+	int middle;
+
+	while (low <= high) {
+		middle = low + (high - low) / 2;
+		if (info->entries[middle].offset == offset) {
+			return info->entries[middle].line;
+		}
+		if (info->entries[middle].offset < offset) {
+			low = middle + 1;
+		} else {
+			high = middle - 1;
+		}
+	}
+
+	return -1;
+}
+
 DebugInfo *mapLineToOffset(char *file, int lineNum, uint32_t *progOffset)
 {
-	int i;
 	DebugInfo *info;
 
 	/*
@@ -132,29 +261,40 @@ DebugInfo *mapLineToOffset(char *file, int lineNum, uint32_t *progOffset)
 		return NULL;
 	}
 
-	/*
-	 * Brute force search for program offset based on line number
-	 * using the simple array mapping.
-	 */
-	for (i = 0; i < info->indexCount; i++) {
-		if (info->indexLine[i] == lineNum) {
-			/*
-			 * Found match.
-			 */
-			*progOffset = info->indexOffset[i] + info->baseAddr;
-			break;
-		}
-	}
-	if (i >= info->indexCount) {
+	if ((lineNum < 1) || ((uint32_t)lineNum > info->maxLine) || (info->lineOffset[lineNum] == DBI_NONE)) {
 		shellPrint("Can't map line (%d) to offset for %s\n", lineNum, file);
 		return NULL;
 	}
+	*progOffset = info->lineOffset[lineNum] + info->baseAddr;
 
 	shellPrint("Mapped line (%d) to offset (0x%X)for %s\n", lineNum, *progOffset, file);
 
 	return info;
 }
 
+int mapOffsetToLine(uint32_t progOffset, char **file, int *lineNum)
+{
+	DebugInfo *info;
+	int line;
+
+	for (info = gInfo; info != NULL; info = info->next) {
+		if (progOffset >= info->baseAddr && progOffset < info->baseAddr + info->binarySize) {
+			break;
+		}
+	}
+	if (info == NULL) {
+		return -1;
+	}
+
+	if ((line = offsetToLine(info, progOffset - info->baseAddr)) < 0) {
+		return -1;
+	}
+	*file = info->sourceFile;
+	*lineNum = line;
+
+	return 0;
+}
+
 void freeDebugInfo(DebugInfo *info)
 {
 	if (info == NULL) {
@@ -164,112 +304,300 @@ void freeDebugInfo(DebugInfo *info)
 	free(info->sourceFile);
 	free(info->debugFile);
 	free(info->binaryFile);
-
-	int i;
-	for (i = 0; i < info->lineCount; i++) {
-		free(info->text[i]);
-	}
+	free(info->dbiFile);
+	free(info->textBuffer);
 	free(info->text);
-
-	/*
-	 * We allocate a single buffer and split it between indexLine
-	 * and indexOffset.
-	 */
-	free(info->indexLine);
+	if (info->dbi != NULL) {
+		dbiUnmap(info->dbi, info->dbiSize);
+	} else {
+		free((void *)info->entries);
+		free((void *)info->lineOffset);
+	}
 
 	free(info);
 }
 
-int loadDebugInfo(char *fileName, uint32_t baseAddr)
+/*
+ * Read the source file in one buffer and split it into lines in place.
+ */
+static int loadSource(DebugInfo *info)
 {
-	DebugInfo *info;
-	FILE *f;
-	char line[4096];
+	struct stat statBuffer;
+	ssize_t n;
+	size_t done;
+	char *p, *end;
+	int fd;
+	int i;
 
-	if ((info = malloc(sizeof(*info))) == NULL) {
-		fprintf(stderr, "Can't allocate info: %s\n", strerror(errno));
+	if (((fd = open(info->sourceFile, O_RDONLY)) < 0) ||
+		(fstat(fd, &statBuffer) < 0)) {
+		fprintf(stderr, "Can't open '%s': %s\n", info->sourceFile, strerror(errno));
 		goto ERROR;
 	}
-	memset(info, 0, sizeof(*info));
-
-	char *marker = strrchr(fileName, '.');
-	if (marker == NULL) {
-		fprintf(stderr, "Can't find file extension.\n");
+	if ((info->textBuffer = malloc(statBuffer.st_size + 1)) == NULL) {
+		fprintf(stderr, "Can't allocate text buffer: %s\n", strerror(errno));
 		goto ERROR;
 	}
-	int len = (uintptr_t)marker - (uintptr_t)fileName;
-	asprintf(&info->sourceFile, "%.*s.asm", len, fileName);
-	asprintf(&info->debugFile, "%.*s.debug", len, fileName);
-	asprintf(&info->binaryFile, "%.*s.bin", len, fileName);
-	fprintf(stderr, "source: %s\n", info->sourceFile);
-	fprintf(stderr, "debug: %s\n", info->debugFile);
-	fprintf(stderr, "binary: %s\n", info->binaryFile);
-
-	/*
-	 * Load all source file lines of text.
-	 */
-	if ((f = fopen(info->sourceFile, "r")) == NULL) {
-		fprintf(stderr, "Can't open '%s': %s\n", info->sourceFile, strerror(errno));
-		goto ERROR;
+	for (done = 0; done < statBuffer.st_size; done += n) {
+		if ((n = read(fd, info->textBuffer + done, statBuffer.st_size - done)) <= 0) {
+			fprintf(stderr, "Can't read '%s': %s\n", info->sourceFile,
+			        n < 0 ? strerror(errno) : "file shrank");
+			goto ERROR;
+		}
 	}
+	close(fd);
+	fd = -1;
 
-	while (fgets(line, sizeof(line), f) != NULL) {
+	end = info->textBuffer + statBuffer.st_size;
+	*end = '\0';
+	for (p = info->textBuffer; p < end; p++) {
+		if (*p == '\n') {
+			info->lineCount++;
+		}
+	}
+	if (end > info->textBuffer && end[-1] != '\n') {
 		info->lineCount++;
 	}
-	fseek(f, 0, SEEK_SET);
-	if ((info->text = malloc(info->lineCount * sizeof(*info->text))) == NULL) {
+
+	if ((info->text = malloc((info->lineCount + 1) * sizeof(*info->text))) == NULL) {
 		fprintf(stderr, "Can't allocate text buffer: %s\n", strerror(errno));
 		goto ERROR;
 	}
-	memset(info->text, 0, info->lineCount * sizeof(*info->text));
+	for (p = info->textBuffer, i = 0; i < info->lineCount; i++) {
+		info->text[i] = p;
+		if ((p = strchr(p, '\n')) == NULL) {
+			break;
+		}
+		*p++ = '\0';
+	}
+
+	return 0;
+
+ERROR:
+	if (fd >= 0) {
+		close(fd);
+	}
+	return -1;
+}
+
+/*
+ * Parse a number of the .debug file, in decimal or with 0x in hex.
+ */
+static int parseNumber(const char **p, const char *end, uint32_t *value)
+{
+	int base = 10;
+	int digit;
+	int digits = 0;
+
+	while (*p < end && isspace((unsigned char)**p)) {
+		(*p)++;
+	}
+	if (end - *p > 2 && (*p)[0] == '0' && ((*p)[1] == 'x' || (*p)[1] == 'X')) {
+		base = 16;
+		*p += 2;
+	}
 
-	int i = 0;
-	while (fgets(line, sizeof(line), f) != NULL) {
-		info->text[i] = strdup(line);
-		i++;
+	for (*value = 0; *p < end; (*p)++, digits++) {
+		if (isdigit((unsigned char)**p)) {
+			digit = **p - '0';
+		} else if (base == 16 && isxdigit((unsigned char)**p)) {
+			digit = tolower((unsigned char)**p) - 'a' + 10;
+		} else {
+			break;
+		}
+		*value = *value * base + digit;
 	}
 
-#if 0
-	fprintf(stderr, "Source file: %s:%d\n", info->sourceFile, info->lineCount);
-	for (i = 0; i < info->lineCount; i++) {
-		fprintf(stderr, "%d: %s", i+1, info->text[i]);
+	return digits > 0 ? 0 : -1;
+}
+
+static int compareEntries(const void *a, const void *b)
+{
+	const struct dbiLine *x = a;
+	const struct dbiLine *y = b;
+
+	if (x->offset != y->offset) {
+		return x->offset < y->offset ? -1 : 1;
 	}
-#endif
+	return x->line < y->line ? -1 : x->line > y->line;
+}
 
-	fclose(f);
+/*
+ * Map the .debug file, parse its "lineNum 0xOffset" lines in one pass
+ * and build both indexes.
+ */
+static int loadLineTable(DebugInfo *info)
+{
+	struct stat statBuffer;
+	const char *map = NULL;
+	const char *p, *end;
+	struct dbiLine *entries = NULL;
+	struct dbiLine *grown;
+	uint32_t *lineOffset;
+	uint32_t lineNum, progOffset;
+	uint32_t maxLine = 0;
+	int count = 0;
+	int capacity = 0;
+	int sorted = 1;
+	int fd;
+	int i;
 
-	/*
-	 * Index each lineNum to progOffset mapping.
-	 */
-	if ((f = fopen(info->debugFile, "r")) == NULL) {
+	if (((fd = open(info->debugFile, O_RDONLY)) < 0) ||
+		(fstat(fd, &statBuffer) < 0)) {
 		fprintf(stderr, "Can't open '%s': %s\n", info->debugFile, strerror(errno));
 		goto ERROR;
 	}
+	if ((statBuffer.st_size > 0) &&
+		((map = mmap(NULL, statBuffer.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+		fprintf(stderr, "Can't map '%s': %s\n", info->debugFile, strerror(errno));
+		map = NULL;
+		goto ERROR;
+	}
+	close(fd);
+	fd = -1;
+
+	p = map;
+	end = map + statBuffer.st_size;
+	while ((parseNumber(&p, end, &lineNum) == 0) &&
+		   (parseNumber(&p, end, &progOffset) == 0)) {
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 1024;
+			if ((grown = realloc(entries, capacity * sizeof(*entries))) == NULL) {
+				fprintf(stderr, "Can't allocate line table: %s\n", strerror(errno));
+				goto ERROR;
+			}
+			entries = grown;
+		}
+		if ((count > 0) && (entries[count - 1].offset > progOffset)) {
+			sorted = 0;
+		}
+		entries[count].offset = progOffset;
+		entries[count].line = lineNum;
+		count++;
+		if (lineNum > maxLine) {
+			maxLine = lineNum;
+		}
+	}
+	if (map != NULL) {
+		munmap((void *)map, statBuffer.st_size);
+		map = NULL;
+	}
 
-	int lineNum, progOffset;
-	i = 0;
-	while ((fscanf(f, "%d %X", &lineNum, &progOffset) == 2) && !feof(f)) {
-		//fprintf(stderr, "%d 0x%X\n", lineNum, progOffset);
-		i++;
+	if (!sorted) {
+		qsort(entries, count, sizeof(*entries), compareEntries);
 	}
-	fseek(f, 0, SEEK_SET);
-	if ((info->indexLine = malloc(sizeof(*info->indexLine) * i * 2)) == NULL) {
-		fprintf(stderr, "Can't allocate line and offset arrays: %s\n", strerror(errno));
+
+	if ((lineOffset = malloc((maxLine + 1) * sizeof(*lineOffset))) == NULL) {
+		fprintf(stderr, "Can't allocate line index: %s\n", strerror(errno));
 		goto ERROR;
 	}
-	info->indexOffset = info->indexLine + i;
-	info->indexCount = i;
+	memset(lineOffset, 0xFF, (maxLine + 1) * sizeof(*lineOffset));
 
-	i = 0;
-	while ((fscanf(f, "%d %X", &lineNum, &progOffset) == 2) && !feof(f)) {
-		info->indexLine[i] = lineNum;
-		info->indexOffset[i] = progOffset;
-		i++;
+	/*
+	 * Entries are in offset order, so the first one seen for a line has
+	 * its lowest offset.
+	 */
+	for (i = 0; i < count; i++) {
+		if (lineOffset[entries[i].line] == DBI_NONE) {
+			lineOffset[entries[i].line] = entries[i].offset;
+		}
 	}
 
-	fclose(f);
+	info->entries = entries;
+	info->entryCount = count;
+	info->lineOffset = lineOffset;
+	info->maxLine = maxLine;
+
+	return 0;
 
+ERROR:
+	free(entries);
+	if (map != NULL) {
+		munmap((void *)map, statBuffer.st_size);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	return -1;
+}
+
+/*
+ * Use the tables of a binary debug info file where they are.
+ */
+static int mapLineTable(DebugInfo *info)
+{
+	if ((info->dbi = dbiMap(info->dbiFile, &info->dbiSize)) == NULL) {
+		return -1;
+	}
+
+	info->entries = dbiLines(info->dbi);
+	info->entryCount = info->dbi->lineCount;
+	info->lineOffset = dbiIndex(info->dbi);
+	info->maxLine = info->dbi->maxLine;
+
+	return 0;
+}
+
+/*
+ * Returns 1 if the .dbi file can stand in for the .debug file, i.e. it
+ * exists and was not left behind by an older assembly.
+ */
+static int dbiCurrent(DebugInfo *info)
+{
+	struct stat dbiStat;
+	struct stat debugStat;
+
+	if ((stat(info->dbiFile, &dbiStat) != 0) || (access(info->dbiFile, R_OK) != 0)) {
+		return 0;
+	}
+	if ((stat(info->debugFile, &debugStat) == 0) && (dbiStat.st_mtime < debugStat.st_mtime)) {
+		fprintf(stderr, "Ignoring '%s', it is older than '%s'\n", info->dbiFile, info->debugFile);
+		return 0;
+	}
+	return 1;
+}
+
+int loadDebugInfo(char *fileName, uint32_t baseAddr)
+{
+	DebugInfo *info;
 	struct stat statBuffer;
+
+	if ((info = malloc(sizeof(*info))) == NULL) {
+		fprintf(stderr, "Can't allocate info: %s\n", strerror(errno));
+		return -1;
+	}
+	memset(info, 0, sizeof(*info));
+
+	char *marker = strrchr(fileName, '.');
+	if (marker == NULL) {
+		fprintf(stderr, "Can't find file extension.\n");
+		goto ERROR;
+	}
+	int len = (uintptr_t)marker - (uintptr_t)fileName;
+	asprintf(&info->sourceFile, "%.*s.asm", len, fileName);
+	asprintf(&info->debugFile, "%.*s.debug", len, fileName);
+	asprintf(&info->binaryFile, "%.*s.bin", len, fileName);
+	asprintf(&info->dbiFile, "%.*s.dbi", len, fileName);
+	fprintf(stderr, "source: %s\n", info->sourceFile);
+
+	if (loadSource(info) < 0) {
+		goto ERROR;
+	}
+
+	/*
+	 * Binary debug info is preferred, its tables need no parsing. If it
+	 * doesn't map, the text line table is read instead.
+	 */
+	if (dbiCurrent(info) && (mapLineTable(info) == 0)) {
+		fprintf(stderr, "debug: %s\n", info->dbiFile);
+	} else {
+		fprintf(stderr, "debug: %s\n", info->debugFile);
+		if (loadLineTable(info) < 0) {
+			goto ERROR;
+		}
+	}
+	fprintf(stderr, "binary: %s\n", info->binaryFile);
+
 	if (stat(info->binaryFile, &statBuffer) < 0) {
 		fprintf(stderr, "Can't stat '%s': %s\n", info->binaryFile, strerror(errno));
 		goto ERROR;
@@ -283,21 +611,7 @@ int loadDebugInfo(char *fileName, uint32_t baseAddr)
 	return 0;
 
 ERROR:
-
-	if (f != NULL) {
-		fclose(f);
-	}
-	if (info != NULL) {
-		free(info->sourceFile);
-		free(info->debugFile);
-		free(info->binaryFile);
-		free(info->indexLine);
-		free(info->indexOffset);
-		if (info->text) {
-			free(info->text);
-		}
-	}
-	free(info);
+	freeDebugInfo(info);
 
 	return -1;
 }
@@ -332,42 +646,218 @@ void dumpRegisters(struct cpuState *cpu, char *message, int printHeader)
 	printf("\n");
 }
 
-void dumpMemory(struct cpuState *cpu, int width)
+/*
+ * Hex digit pairs and the ASCII column for every byte value, so that a
+ * dump line is built with table lookups only.
+ */
+static char hexPairs[256][2];
+static char dumpChar[256];
+
+static void initDumpTables()
 {
-	int64_t i;
-	uint64_t addr;
-	uint8_t *line = NULL;
-	int duplicate;
-
-	duplicate = 0;
-	for (addr = 0; addr < cpu->memSize; ++addr) {
-		if ((addr % width) == 0) {
-			if ((line != NULL) &&
-				(addr + width < cpu->memSize) &&
-				(memcmp(line, cpu->mem+addr, width) == 0)) {
-				if (duplicate == 0) {
-					shellPrint("\n*");
-					duplicate = 1;
-				}
-				addr += (width-1);
-				continue;
+	static const char digits[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		hexPairs[i][0] = digits[i >> 4];
+		hexPairs[i][1] = digits[i & 0xF];
+		dumpChar[i] = isgraph(i) ? i : '.';
+	}
+}
+
+/*
+ * Send 'length' bytes of dump text to 'stream', or to the shell window
+ * one line at a time when it is NULL.
+ */
+static void dumpFlush(char *text, size_t length, FILE *stream)
+{
+	char *line, *end;
+
+	if (stream != NULL) {
+		fwrite(text, 1, length, stream);
+		return;
+	}
+
+	text[length] = '\0';
+	for (line = text; (end = strchr(line, '\n')) != NULL; line = end + 1) {
+		*end = '\0';
+		shellPrint("%s\n", line);
+	}
+}
+
+void dumpMemory(struct cpuState *cpu, uint32_t start, uint32_t length, int width, FILE *stream)
+{
+	uint64_t addr, end;
+	const uint8_t *line;
+	const uint8_t *previous = NULL;
+	size_t lineSize = 2 + 8 + 3 * width + 3 + width + 2;
+	size_t chunkSize = 64 * 1024;
+	size_t used = 0;
+	char *chunk;
+	char *p;
+	int duplicate = 0;
+	int i, n;
+
+	if (hexPairs[0][0] == '\0') {
+		initDumpTables();
+	}
+
+	end = (uint64_t)start + length;
+	if (end > cpu->memSize) {
+		end = cpu->memSize;
+	}
+
+	/*
+	 * One line at a time in the shell window, it has to be positioned.
+	 */
+	if (stream == NULL) {
+		chunkSize = lineSize;
+	}
+	if (chunkSize < lineSize) {
+		chunkSize = lineSize;
+	}
+	if ((chunk = malloc(chunkSize + 1)) == NULL) {
+		shellPrint("Can't allocate dump buffer: %s\n", strerror(errno));
+		return;
+	}
+
+	for (addr = start; addr < end; addr += width) {
+		line = cpu->mem + addr;
+		n = end - addr < width ? end - addr : width;
+
+		/*
+		 * Runs of lines equal to the one before are one "*", except for
+		 * the last line, which shows where the range ends.
+		 */
+		if ((previous != NULL) && (n == width) && (addr + width < end) &&
+			(memcmp(previous, line, width) == 0)) {
+			if (duplicate == 0) {
+				chunk[used++] = '*';
+				chunk[used++] = '\n';
+				duplicate = 1;
 			}
+		} else {
 			duplicate = 0;
-			line = cpu->mem+addr;
-			shellPrint("\n");
-			shellPrint("0x%.4" PRIX64, addr);
-		}
-		shellPrint(" %.2x", cpu->mem[addr]);
-		if ((((addr+1) % width) == 0) || (addr == cpu->memSize)) {
-			shellPrint("  >");
-			for (i = width - 1; i >= 0; --i) {
-				char c = cpu->mem[addr-i];
-				shellPrint("%c", isgraph(c) ? c : '.');
+			previous = line;
+
+			p = chunk + used;
+			*p++ = '0';
+			*p++ = 'x';
+			for (i = 24; i >= 0; i -= 8) {
+				memcpy(p, hexPairs[(addr >> i) & 0xFF], 2);
+				p += 2;
 			}
-			shellPrint("<");
+			for (i = 0; i < width; i++) {
+				*p++ = ' ';
+				if (i < n) {
+					memcpy(p, hexPairs[line[i]], 2);
+				} else {
+					p[0] = p[1] = ' ';
+				}
+				p += 2;
+			}
+			*p++ = ' ';
+			*p++ = ' ';
+			*p++ = '>';
+			for (i = 0; i < n; i++) {
+				*p++ = dumpChar[line[i]];
+			}
+			*p++ = '<';
+			*p++ = '\n';
+			used = p - chunk;
+		}
+
+		if (chunkSize - used < lineSize) {
+			dumpFlush(chunk, used, stream);
+			used = 0;
+		}
+	}
+	dumpFlush(chunk, used, stream);
+
+	free(chunk);
+}
+
+static inline int breakpointAt(uint32_t pc)
+{
+	uint32_t page = pc >> BP_PAGE_SHIFT;
+	uint32_t bit = pc & (BP_PAGE_SIZE - 1);
+
+	if (page >= bp_page_count || bp_pages[page] == NULL) {
+		return 0;
+	}
+	return (bp_pages[page][bit / 8] >> (bit % 8)) & 1;
+}
+
+static int setBreakpointBit(uint32_t pc)
+{
+	uint32_t page = pc >> BP_PAGE_SHIFT;
+	uint32_t bit = pc & (BP_PAGE_SIZE - 1);
+	uint8_t **pages;
+
+	if (page >= bp_page_count) {
+		if ((pages = realloc(bp_pages, (page + 1) * sizeof(*pages))) == NULL) {
+			return -1;
+		}
+		memset(pages + bp_page_count, 0, (page + 1 - bp_page_count) * sizeof(*pages));
+		bp_pages = pages;
+		bp_page_count = page + 1;
+	}
+	if ((bp_pages[page] == NULL) &&
+		((bp_pages[page] = calloc(1, BP_PAGE_SIZE / 8)) == NULL)) {
+		return -1;
+	}
+	bp_pages[page][bit / 8] |= 1 << (bit % 8);
+
+	return 0;
+}
+
+/*
+ * Rebuild the PC bitmap from bp_list after it changed.
+ */
+static void indexBreakpoints()
+{
+	struct breakpoint *bp;
+	uint32_t i;
+
+	uint64_t page;
+
+	for (i = 0; i < bp_page_count; i++) {
+		free(bp_pages[i]);
+	}
+	free(bp_pages);
+	bp_pages = NULL;
+	bp_page_count = 0;
+	bp_finish_count = 0;
+	free(watchPages);
+	watchPages = NULL;
+
+	for (bp = bp_list; bp != NULL; bp = bp->next) {
+		switch (bp->type) {
+			case BP_PC:
+			case BP_LINE:
+				if (setBreakpointBit(bp->condition) < 0) {
+					shellPrint("Can't allocate breakpoint bitmap.\n");
+				}
+				break;
+			case BP_FINISH:
+				bp_finish_count++;
+				break;
+			case BP_MEM_RD:
+			case BP_MEM_WR:
+			case BP_MEM_RDWR:
+				if ((watchPages == NULL) &&
+					((watchPages = calloc(1, WATCH_PAGES / 8)) == NULL)) {
+					shellPrint("Can't allocate watchpoint bitmap.\n");
+					break;
+				}
+				for (page = bp->num1 >> WATCH_PAGE_SHIFT;
+					 page <= ((uint64_t)bp->num1 + bp->num2 - 1) >> WATCH_PAGE_SHIFT;
+					 page++) {
+					watchPages[page / 8] |= 1 << (page % 8);
+				}
+				break;
 		}
 	}
-	shellPrint("\n");
 }
 
 void deleteBreakpoint(uint64_t n)
@@ -385,10 +875,36 @@ void deleteBreakpoint(uint64_t n)
 			} else {
 				prev->next = bp->next;
 			}
+			conditionFree(bp->expr);
 			free(bp);
 			break;
 		}
 	}
+	indexBreakpoints();
+}
+
+static struct breakpoint *findBreakpoint(uint64_t n)
+{
+	struct breakpoint *bp;
+
+	for (bp = bp_list; bp != NULL && bp->id != n; bp = bp->next) {
+	}
+	return bp;
+}
+
+/*
+ * Set how many more times breakpoint 'n' is passed before it stops.
+ */
+void ignoreBreakpoint(uint64_t n, uint64_t count)
+{
+	struct breakpoint *bp = findBreakpoint(n);
+
+	if (bp == NULL) {
+		shellPrint("No breakpoint #%" PRIX64 "\n", n);
+		return;
+	}
+	bp->ignore = count;
+	shellPrint("Breakpoint #%" PRIX64 " ignores the next %" PRIu64 " hits\n", n, count);
 }
 
 void deleteAllBreakpoints()
@@ -398,12 +914,60 @@ void deleteAllBreakpoints()
 	}
 }
 
+/*
+ * Parse a number or a ".label[+offset]" from the symbol tables.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+static int parseAddress(const char *text, uint32_t *address)
+{
+	char name[512];
+	const char *plus;
+	char *end;
+	uint32_t base = 0;
+	uint64_t value;
+	int len;
+
+	if (text[0] == '.') {
+		plus = strchr(text, '+');
+		len = plus != NULL ? plus - text : strlen(text);
+		snprintf(name, sizeof(name), "%.*s", len, text);
+		if (symbolsLookupName(name, &base) < 0) {
+			shellPrint("Unknown label: %s\n", name);
+			return -1;
+		}
+		if (plus == NULL) {
+			*address = base;
+			return 0;
+		}
+		text = plus + 1;
+	}
+
+	/*
+	 * Use strtoull() so that it can interpret base for us.
+	 */
+	errno = 0;
+	value = strtoull(text, &end, 0);
+	if ((errno != 0) || (end == text) || (*end != '\0') || (base + value > UINT32_MAX)) {
+		shellPrint("Can't parse address: %s\n", text);
+		return -1;
+	}
+	*address = base + value;
+
+	return 0;
+}
+
 uint64_t addBreakpoint(char *args)
 {
 	struct breakpoint *bp;
 	int type = -1;
 	int i;
 	char name[512];
+	char error[512];
+	char token[512];
+	char where[512];
+	char *condition;
 
 	/*
 	 * What type of breakpoint is  this?
@@ -424,9 +988,22 @@ uint64_t addBreakpoint(char *args)
 	bp = malloc(sizeof(*bp));
 	memset(bp, 0, sizeof(*bp));
 	bp->type = type;
-	bp->maxHits = UINT64_MAX;
 	bp->condition = 0;
 
+	/*
+	 * An optional condition follows the arguments: "... if <expr>". It is
+	 * compiled here, so that a hit only costs running the result.
+	 */
+	if ((condition = strstr(args, " if ")) != NULL) {
+		strncpy(bp->exprText, condition + 4, sizeof(bp->exprText) - 1);
+		if ((bp->expr = conditionCompile(bp->exprText, error, sizeof(error))) == NULL) {
+			shellPrint("Bad condition: %s\n", error);
+			free(bp);
+			return UINT64_MAX;
+		}
+		*condition = '\0';
+	}
+
 	/*
 	 * Parse arguments.
 	 */
@@ -434,23 +1011,22 @@ uint64_t addBreakpoint(char *args)
 		case BP_LINE:
 			if (sscanf(args, "%s %d", bp->opt1, &bp->num1) != 2) {
 				shellPrint("Line break format: <file> <line>\n");
+				conditionFree(bp->expr);
 				free(bp);
 				return UINT64_MAX;
 			}
 			shellPrint("Setting breakpoint for %s:%d\n", bp->opt1, bp->num1);
 			if (mapLineToOffset(bp->opt1, (int)bp->num1, &bp->condition) == NULL) {
+				conditionFree(bp->expr);
+				free(bp);
 				return UINT64_MAX;
 			}
 			break;
 		case BP_PC:
-			/*
-			 * Use strtoull() so that it can interpret base for us.
-			 */
-			errno = 0;
-			bp->condition = strtoull(args, NULL, 0);
-			if (errno != 0) {
-				shellPrint("Can't parse PC value: %s\n", strerror(errno));
-				shellPrint("PC break format: <PC value>\n");
+			if ((sscanf(args, "%511s", token) != 1) ||
+				(parseAddress(token, &bp->condition) < 0)) {
+				shellPrint("PC break format: <PC value or .label[+offset]>\n");
+				conditionFree(bp->expr);
 				free(bp);
 				return UINT64_MAX;
 			}
@@ -458,6 +1034,20 @@ uint64_t addBreakpoint(char *args)
 		case BP_MEM_RD:
 		case BP_MEM_WR:
 		case BP_MEM_RDWR:
+			/*
+			 * An address and an optional length in bytes.
+			 */
+			bp->num2 = 4;
+			if ((sscanf(args, "%511s %i", token, &bp->num2) < 1) ||
+				(parseAddress(token, &bp->num1) < 0) ||
+				(bp->num2 == 0) || ((uint64_t)bp->num1 + bp->num2 > UINT32_MAX + 1ULL)) {
+				shellPrint("Watchpoint format: <address or .label[+offset]> [<length>]\n");
+				conditionFree(bp->expr);
+				free(bp);
+				return UINT64_MAX;
+			}
+			bp->condition = bp->num1;
+			break;
 		case BP_FINISH:
 			break;
 		default:
@@ -472,68 +1062,195 @@ uint64_t addBreakpoint(char *args)
 	bp_list_count++;
 	bp->next = bp_list;
 	bp_list = bp;
+	indexBreakpoints();
 
-	shellPrint("Set breakpoint: %s 0x%" PRIX32 "\n", name, bp->condition);
+	symbolsFormat(bp->condition, where, sizeof(where));
+	if (bp->expr != NULL) {
+		shellPrint("Set breakpoint: %s 0x%" PRIX32 " (%s) if %s\n", name, bp->condition, where, bp->exprText);
+	} else {
+		shellPrint("Set breakpoint: %s 0x%" PRIX32 " (%s)\n", name, bp->condition, where);
+	}
 
 	return(bp->id);
 }
 
+/*
+ * Count a hit of 'bp' and decide whether it stops the program.
+ */
+static int triggered(struct breakpoint *bp, struct cpuState *cpu)
+{
+	bp->hits++;
+	if (bp->expr != NULL && conditionEval(bp->expr, cpu, bp->hits) == 0) {
+		return 0;
+	}
+	if (bp->ignore > 0) {
+		bp->ignore--;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Returns 1 if the PC, line or finish breakpoint 'bp' is at 'o'.
+ */
+static int reached(struct breakpoint *bp, struct cpuState *cpu, struct instruction *o)
+{
+	switch (bp->type) {
+		case BP_PC:
+		case BP_LINE:
+			return cpu->pc == bp->condition;
+		case BP_FINISH:
+			return (o->op == jmp) && ((o->mode & MODE_OPERAND) == OPR_REG) && (o->raw2 == 4);
+	}
+	return 0;
+}
+
 int hitBreakpoint(struct cpuState *cpu, struct instruction *o)
 {
-	struct breakpoint *hitBP = NULL;
 	struct breakpoint *bp;
-	uint64_t i;
+	struct breakpoint *next;
+	char where[512];
+	int hit = 0;
 
-	for (bp = bp_list, i = 0; bp != NULL; bp = bp->next, ++i) {
+	if (!breakpointAt(cpu->pc) && bp_finish_count == 0) {
+		return 0;
+	}
+
+	for (bp = bp_list; bp != NULL; bp = next) {
+		next = bp->next;
+		if (!reached(bp, cpu, o) || !triggered(bp, cpu)) {
+			continue;
+		}
 		switch (bp->type) {
 			case BP_PC:
-				if (cpu->pc == bp->condition) {
-					shellPrint("Hit breakpoint #%" PRIX64 ": PC == 0x%" PRIX32 "\n", i, cpu->pc);
-					hitBP = bp;
-				}
+				symbolsFormat(cpu->pc, where, sizeof(where));
+				shellPrint("Hit breakpoint #%" PRIX64 ": PC == 0x%" PRIX32 " (%s)\n", bp->id, cpu->pc, where);
 				break;
 			case BP_FINISH:
-				if ((o->op == jmp) && ((o->mode & MODE_OPERAND) == OPR_REG) && (o->raw2 == 4)) {
-					shellPrint("Hit breakpoint #%" PRIX64 ": jmp r4\n", i);
-					hitBP = bp;
-				}
+				shellPrint("Hit breakpoint #%" PRIX64 ": jmp r4\n", bp->id);
 				break;
 			case BP_LINE:
-				if (cpu->pc == bp->condition) {
-					shellPrint("Hit breakpoint #%" PRIX64 ": line(%s:%d) or progOffset(0x%" PRIX64 ")\n",
-					           i, bp->opt1, bp->num1, bp->condition);
-					hitBP = bp;
-				}
+				shellPrint("Hit breakpoint #%" PRIX64 ": line(%s:%d) or progOffset(0x%" PRIX32 ")\n",
+				           bp->id, bp->opt1, bp->num1, bp->condition);
 				break;
 		}
+
+		hit = 1;
+		if (bp->temporary) {
+			deleteBreakpoint(bp->id);
+		}
+	}
+
+	return hit;
+}
+
+void debuggerWatch(uint32_t pc, uint32_t address, uint32_t size, int write)
+{
+	struct breakpoint *bp;
+
+	for (bp = bp_list; bp != NULL; bp = bp->next) {
+		if (bp->watched) {
+			continue;
+		}
+		if ((bp->type == BP_MEM_RDWR) ||
+			(bp->type == BP_MEM_RD && !write) ||
+			(bp->type == BP_MEM_WR && write)) {
+			if (address < bp->num1 + (uint64_t)bp->num2 && bp->num1 < address + (uint64_t)size) {
+				bp->watched = 1;
+				bp->watchAddress = address;
+				bp->watchPC = pc;
+				watch_hits++;
+			}
+		}
+	}
+}
+
+/*
+ * Report the watchpoints hit by the last instruction.
+ */
+static int hitWatchpoint(struct cpuState *cpu)
+{
+	struct breakpoint *bp;
+	struct breakpoint *next;
+	char where[512];
+	char at[512];
+	int hit = 0;
+
+	if (watch_hits == 0) {
+		return 0;
 	}
+	watch_hits = 0;
+
+	for (bp = bp_list; bp != NULL; bp = next) {
+		next = bp->next;
+		if (!bp->watched) {
+			continue;
+		}
+		bp->watched = 0;
+		if (!triggered(bp, cpu)) {
+			continue;
+		}
 
-	if (hitBP != NULL && hitBP->maxHits != UINT64_MAX) {
-		hitBP->maxHits--;
-		if (hitBP->maxHits == 0) {
-			deleteBreakpoint(hitBP->id);
+		symbolsFormat(bp->watchAddress, where, sizeof(where));
+		symbolsFormat(bp->watchPC, at, sizeof(at));
+		shellPrint("Hit watchpoint #%" PRIX64 ": %s 0x%" PRIX32 " [%s] (%" PRIu32 " bytes at 0x%" PRIX32 ") by %s\n",
+		           bp->id, bp_table[bp->type].name, bp->watchAddress, where, bp->num2, bp->num1, at);
+		hit = 1;
+		if (bp->temporary) {
+			deleteBreakpoint(bp->id);
 		}
 	}
 
-	return(hitBP != NULL);
+	return hit;
 }
 
 void listBreakpoints()
 {
 	struct breakpoint *bp;
-	uint64_t i;
+	char line[1024];
+	char where[512];
+	int n;
 
 	shellPrint("Breakpoints:\n");
-	for (bp = bp_list, i = 0; bp != NULL; bp = bp->next, ++i) {
+	for (bp = bp_list; bp != NULL; bp = bp->next) {
+		symbolsFormat(bp->condition, where, sizeof(where));
 		switch (bp->type) {
 			case BP_LINE:
-				shellPrint(" #%" PRIX64 " line(%s:%d) or progOffset(0x%" PRIX64 ")\n",
-						   i, bp->opt1, bp->num1, bp->condition);
+				n = snprintf(line, sizeof(line), " #%" PRIX64 " line(%s:%d) or progOffset(0x%" PRIX32 ")",
+				             bp->id, bp->opt1, bp->num1, bp->condition);
+				break;
+			case BP_MEM_RD:
+			case BP_MEM_WR:
+			case BP_MEM_RDWR:
+				n = snprintf(line, sizeof(line), " #%" PRIX64 " %s %" PRIu32 " bytes at 0x%" PRIX32 " (%s)",
+				             bp->id, bp_table[bp->type].name, bp->num2, bp->num1, where);
+				break;
+			case BP_PC:
+				n = snprintf(line, sizeof(line), " #%" PRIX64 " %s == %" PRIX32 " (%s)",
+				             bp->id, bp_table[bp->type].name, bp->condition, where);
 				break;
 			default:
-				shellPrint(" #%" PRIX64 " %s == %" PRIX64 "\n", i, bp_table[bp->type].name, bp->condition);
+				n = snprintf(line, sizeof(line), " #%" PRIX64 " %s == %" PRIX32,
+				             bp->id, bp_table[bp->type].name, bp->condition);
 				break;
 		}
+
+		/*
+		 * shellPrint() starts a new line every call, so build it first.
+		 */
+		if (bp->expr != NULL && n < sizeof(line)) {
+			n += snprintf(line + n, sizeof(line) - n, " if %s", bp->exprText);
+		}
+		if (n < sizeof(line)) {
+			n += snprintf(line + n, sizeof(line) - n, ", %" PRIu64 " hits", bp->hits);
+		}
+		if (bp->ignore > 0 && n < sizeof(line)) {
+			n += snprintf(line + n, sizeof(line) - n, ", ignoring %" PRIu64, bp->ignore);
+		}
+		if (bp->temporary && n < sizeof(line)) {
+			snprintf(line + n, sizeof(line) - n, ", temporary");
+		}
+		shellPrint("%s\n", line);
 	}
 }
 
@@ -601,20 +1318,7 @@ static int updateCodeWindow(Window *code, int progOffset)
 		return 0;
 	}
 
-	/*
-	 * Brute force search for line number based on program offset
-	 * using the simple array mapping.
-	 */
-	for (i = 0; i < info->indexCount; i++) {
-		if (info->indexOffset[i] + info->baseAddr == progOffset) {
-			/*
-			 * Found match.
-			 */
-			lineNum = info->indexLine[i];
-			break;
-		}
-	}
-	if (i >= info->indexCount) {
+	if ((lineNum = offsetToLine(info, progOffset - info->baseAddr)) < 0) {
 		shellPrint("Can't map offset (0x%X) to line for %s\n", progOffset, info->sourceFile);
 		return 0;
 	}
@@ -672,7 +1376,8 @@ static int updateCodeWindow(Window *code, int progOffset)
 		 */
 		int charCount;
 		int expandedCount = 0;
-		for (charCount = 0; charCount < strlen(info->text[nextLine]); charCount++) {
+		int length = strlen(info->text[nextLine]);
+		for (charCount = 0; charCount < length; charCount++) {
 			int len = 1;
 			if (info->text[nextLine][charCount] == '\t') {
 				len = TAB_WIDTH;
@@ -683,6 +1388,7 @@ static int updateCodeWindow(Window *code, int progOffset)
 			expandedCount += len;
 		}
 		mvwprintw(code->wn, 1 + i, 7, "%.*s", expandedCount, info->text[nextLine]);
+		wclrtoeol(code->wn);
 
 		if (nextLine == lineNum) {
 			wattroff(code->wn, COLOR_PAIR(2));
@@ -701,13 +1407,18 @@ static int updateRegsWindow(Window *regs, struct cpuState *cpu)
 	 */
 	int i;
 	char buf[256];
+	char where[256];
 	int maxRegStr = strlen("r15: -0x0000000000");
 
 	/*
-	 * Explicitly print PC register.
+	 * Explicitly print PC register, with the label it is in. It has the
+	 * whole line.
 	 */
-	sprintf(buf, "PC: 0x%" PRIX32, cpu->pc);
-	sprintf(buf+strlen(buf), "%*s", (int)maxRegStr - (int)strlen(buf), " ");
+	sprintf(buf, "PC: 0x%" PRIX32 " ", cpu->pc);
+	if (symbolsFormat(cpu->pc, where, sizeof(where)) == 0) {
+		snprintf(buf + strlen(buf), 2 * maxRegStr - strlen(buf) + 1, "%s", where);
+	}
+	sprintf(buf+strlen(buf), "%*s", 2 * (int)maxRegStr - (int)strlen(buf), " ");
     mvwaddstr(regs->wn, 2, 1, buf);
 
 	/*
@@ -725,6 +1436,194 @@ static int updateRegsWindow(Window *regs, struct cpuState *cpu)
 	return 0;
 }
 
+/*
+ * First address of the memory window for 'cpu'.
+ */
+static uint32_t memBase(struct cpuState *cpu)
+{
+	uint32_t address = memAddress;
+
+	if (memFollow == MEM_FOLLOW_PC) {
+		address = cpu->pc;
+	} else if (memFollow != MEM_FOLLOW_ADDRESS) {
+		address = cpu->r[memFollow];
+	}
+
+	return (address & ~(uint32_t)(memWidth - 1)) + (uint32_t)(memScroll * memWidth);
+}
+
+/*
+ * Returns how many of the window's bytes from 'base' are in memory.
+ */
+static uint32_t memAvailable(struct cpuState *cpu, uint32_t base)
+{
+	uint32_t size = memLines * memWidth;
+
+	if (base >= cpu->memSize) {
+		return 0;
+	}
+	return cpu->memSize - base < size ? cpu->memSize - base : size;
+}
+
+/*
+ * Draw the 'count' bytes at 'bytes', which are at 'base' in guest memory,
+ * as hex and ASCII. Bytes past 'count' are outside memory.
+ */
+static int updateMemWindow(Window *mem, uint32_t base, const uint8_t *bytes, uint32_t count)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	char buf[1024];
+	int changed = 0;
+	int line, i, n, len;
+
+	for (line = 0; line < memLines; line++) {
+		uint32_t address = base + line * memWidth;
+		uint32_t first = line * memWidth;
+		const uint8_t *p = bytes + first;
+
+		n = first >= count ? 0 : count - first < memWidth ? count - first : memWidth;
+		if ((memShownCount[line] == n) && (memShownAddress[line] == address) &&
+			(memcmp(memShown + first, p, n) == 0)) {
+			continue;
+		}
+		memShownCount[line] = n;
+		memShownAddress[line] = address;
+		memcpy(memShown + first, p, n);
+		changed = 1;
+
+		len = sprintf(buf, "%08" PRIX32 "  ", address);
+		for (i = 0; i < memWidth; i++) {
+			if (i < n) {
+				buf[len++] = hex[p[i] >> 4];
+				buf[len++] = hex[p[i] & 0xF];
+			} else {
+				buf[len++] = '-';
+				buf[len++] = '-';
+			}
+			buf[len++] = ' ';
+			if ((i % 8) == 7) {
+				buf[len++] = ' ';
+			}
+		}
+		for (i = 0; i < memWidth; i++) {
+			buf[len++] = i >= n ? ' ' : isprint(p[i]) ? p[i] : '.';
+		}
+		buf[len] = '\0';
+		mvwaddnstr(mem->wn, 2 + line, 1, buf, mem->w - 2);
+	}
+
+	if (changed) {
+		wrefresh(mem->wn);
+	}
+
+	return 0;
+}
+
+static void showMemory(struct cpuState *cpu)
+{
+	uint32_t base = memBase(cpu);
+	uint32_t count = memAvailable(cpu, base);
+
+	updateMemWindow(mem, base, count > 0 ? cpu->mem + base : cpu->mem, count);
+}
+
+/*
+ * m [<width>] or m <start> <length> [<width>], then optionally
+ * "> <file>" to write the dump to a file.
+ */
+static void dumpCommand(struct cpuState *cpu, char *args)
+{
+	char opt[3][512];
+	char *redirect;
+	char fileName[512];
+	FILE *stream = NULL;
+	uint32_t start = 0;
+	uint32_t length = cpu->memSize;
+	uint32_t width = 16;
+	int n;
+
+	if ((redirect = strchr(args, '>')) != NULL) {
+		if (sscanf(redirect + 1, "%511s", fileName) != 1) {
+			shellPrint("Memory dump format: m [<start> <length>] [<width>] [> <file>]\n");
+			return;
+		}
+		*redirect = '\0';
+	}
+
+	n = sscanf(args, "%511s %511s %511s", opt[0], opt[1], opt[2]);
+	if (n == 1) {
+		width = strtoul(opt[0], NULL, 0);
+	} else if (n >= 2) {
+		if ((parseAddress(opt[0], &start) < 0) || (parseAddress(opt[1], &length) < 0)) {
+			return;
+		}
+		if (n == 3) {
+			width = strtoul(opt[2], NULL, 0);
+		}
+	}
+	if ((width == 0) || (width > 256)) {
+		shellPrint("Memory dump width must be 1 to 256 bytes\n");
+		return;
+	}
+
+	if (redirect != NULL) {
+		if ((stream = fopen(fileName, "w")) == NULL) {
+			shellPrint("Can't open '%s': %s\n", fileName, strerror(errno));
+			return;
+		}
+	} else if (simpleTUI != 0) {
+		stream = stdout;
+	}
+
+	dumpMemory(cpu, start, length, width, stream);
+
+	if (redirect != NULL) {
+		fclose(stream);
+		shellPrint("Wrote memory 0x%" PRIX32 " to '%s'\n", start, fileName);
+	}
+}
+
+/*
+ * Point the memory window at "sp", "pc", "r<n>", an address or a label,
+ * or scroll it by "+<lines>" or "-<lines>".
+ */
+static void setMemWindow(char *args)
+{
+	char where[512];
+	uint32_t address;
+	int reg;
+
+	if (sscanf(args, "%511s", where) != 1) {
+		if (memFollow == MEM_FOLLOW_PC) {
+			shellPrint("Memory window follows pc%+d lines\n", memScroll);
+		} else if (memFollow != MEM_FOLLOW_ADDRESS) {
+			shellPrint("Memory window follows r%d%+d lines\n", memFollow, memScroll);
+		} else {
+			shellPrint("Memory window at 0x%" PRIX32 "%+d lines\n", memAddress, memScroll);
+		}
+		return;
+	}
+
+	if ((where[0] == '+') || (where[0] == '-')) {
+		memScroll += strtol(where, NULL, 0);
+		return;
+	}
+	if (strcmp(where, "sp") == 0) {
+		memFollow = R_SP;
+	} else if (strcmp(where, "pc") == 0) {
+		memFollow = MEM_FOLLOW_PC;
+	} else if ((sscanf(where, "r%d", &reg) == 1) && (reg >= 0) && (reg < NUM_REGISTERS)) {
+		memFollow = reg;
+	} else if (parseAddress(where, &address) == 0) {
+		memFollow = MEM_FOLLOW_ADDRESS;
+		memAddress = address;
+	} else {
+		shellPrint("Memory window format: mw [sp|pc|r<n>|<address>|.label[+offset]|+<lines>|-<lines>]\n");
+		return;
+	}
+	memScroll = 0;
+}
+
 /*
  * -1 An error occurred.
  *  0 Keep accepting user commands.
@@ -738,7 +1637,7 @@ static int parseCommand(struct cpuState *cpu, char input[4096])
 	static char	savedInput[4096] = "s";
 
 	opt1[0] = '\0';
-	if (input[strlen(input)-1] == '\n') {
+	if ((input[0] != '\0') && (input[strlen(input)-1] == '\n')) {
 		input[strlen(input)-1] = '\0';
 	}
 	if (input[0] != '\0') {
@@ -755,22 +1654,35 @@ static int parseCommand(struct cpuState *cpu, char input[4096])
 		keepGoing = 1;
 		return 1;
 	}
-	if (input[0] == 'm') {
-		sscanf(input, "%s %s", cmd, opt1);
-		num = 16;
-		if (opt1[0] != '\0') {
-			num = strtoull(opt1, NULL, 0);
+	if ((input[0] == 'm') && (input[1] == 'w')) {
+		if (simpleTUI == 0) {
+			setMemWindow(input + 2);
+			showMemory(cpu);
 		}
-		if (simpleTUI != 0) {
-			//TODO: Support dumping memory to the shell window.
-			dumpMemory(cpu, (int)num);
+		return 0;
+	}
+	if (input[0] == 'm') {
+		dumpCommand(cpu, input + 1);
+	}
+	if ((strcmp(input, "rs") == 0) || (strcmp(input, "rc") == 0)) {
+		if (reverseStart(input[1] == 's' ? REVERSE_STEP : REVERSE_CONTINUE) < 0) {
+			shellPrint("No recorded history before this instruction (see --reverse)\n");
+			return 0;
 		}
+		keepGoing = 0;
+		return 1;
 	}
 	if (input[0] == 'r') {
 		dumpRegisters(cpu, cpu->msg, 0);
 	}
 	if (input[0] == 'f') {
-		addBreakpoint("fin");
+		/*
+		 * A one shot breakpoint, gone once the function returns.
+		 */
+		num = addBreakpoint("fin");
+		if (num != UINT64_MAX) {
+			findBreakpoint(num)->temporary = 1;
+		}
 		keepGoing = 1;
 		return 1;
 	}
@@ -790,17 +1702,30 @@ static int parseCommand(struct cpuState *cpu, char input[4096])
 			deleteAllBreakpoints();
 		}
 	}
+	if (input[0] == 'i') {
+		opt1[0] = '\0';
+		cmd[0] = '\0';
+		if (sscanf(input, "%*s %s %s", opt1, cmd) != 2) {
+			shellPrint("Ignore format: i <breakpoint> <count>\n");
+		} else {
+			ignoreBreakpoint(strtoull(opt1, NULL, 0), strtoull(cmd, NULL, 0));
+		}
+	}
 	if (input[0] == 'q') {
 		return 1;
 	}
 	if (input[0] == 'h') {
 		shellPrint("s - step forward one instruction\n");
 		shellPrint("c - continue until breakpoint or end of execution\n");
-		shellPrint("m - print memory contents\n");
+		shellPrint("m - dump memory: m [<start> <length>] [<width>] [> <file>]\n");
+		shellPrint("mw - memory window follows sp, pc, r<n> or an address, +/-<lines> scrolls\n");
 		shellPrint("r - print register contents\n");
-		shellPrint("b - list or add breakpoints\n");
+		shellPrint("b - list or add breakpoints (pc, line, rd, wr, rdwr, fin) [if <condition>]\n");
 		shellPrint("d - delete breakpoints\n");
+		shellPrint("i - ignore the next <count> hits of a breakpoint\n");
 		shellPrint("f - continue until return from function\n");
+		shellPrint("rs - step back one instruction\n");
+		shellPrint("rc - continue back to the previous breakpoint or watchpoint hit\n");
 	}
 
 	return 0;
@@ -892,18 +1817,6 @@ static int updateShellWindow(Window *shell, struct cpuState *cpu, struct instruc
 {
 	char	input[4096];
 
-	if (checkForSignals() > 0) {
-		keepGoing = 0;
-	}
-
-	if (hitBreakpoint(cpu, o) != 0) {
-		keepGoing = 0;
-	}
-
-	if (keepGoing != 0) {
-		return 0;
-	}
-
 	/*
 	 * Remove signal handlers while waiting for shell input.
 	 */
@@ -939,14 +1852,6 @@ int updateSimple(struct cpuState *cpu, struct instruction *o)
 {
 	char	input[4096];
 
-	if (hitBreakpoint(cpu, o) != 0) {
-		keepGoing = 0;
-	}
-
-	if (keepGoing != 0) {
-		return 0;
-	}
-
 	printf("#> ");
 
 	while (fgets(input, 4096, stdin) != NULL) {
@@ -959,8 +1864,103 @@ int updateSimple(struct cpuState *cpu, struct instruction *o)
 	return 0;
 }
 
-int initTUI()
+/*
+ * Runs while continuing: draws the latest snapshot, asks for the next one
+ * and turns a key press into a pause.
+ */
+static void *uiLoop(void *arg)
+{
+	struct cpuState frame;
+	uint32_t frameBase = 0;
+	uint32_t frameCount = 0;
+	int ready;
+
+	while (!__atomic_load_n(&uiQuit, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&snapshotLock);
+		if ((ready = snapshotReady) != 0) {
+			frame = snapshot;
+			frameBase = snapshotBase;
+			frameCount = snapshotCount;
+			memcpy(uiMem, snapshotMem, frameCount);
+			snapshotReady = 0;
+		}
+		pthread_mutex_unlock(&snapshotLock);
+		__atomic_fetch_or(&uiRequest, UI_SNAPSHOT, __ATOMIC_RELEASE);
+
+		pthread_mutex_lock(&screenLock);
+		if (ready) {
+			updateCodeWindow(code, frame.pc);
+			updateRegsWindow(regs, &frame);
+			updateMemWindow(mem, frameBase, uiMem, frameCount);
+		}
+		if (wgetch(shell->wn) != ERR) {
+			__atomic_fetch_or(&uiRequest, UI_PAUSE, __ATOMIC_RELEASE);
+		}
+		pthread_mutex_unlock(&screenLock);
+
+		usleep(UI_FRAME_US);
+	}
+
+	return NULL;
+}
+
+static void takeSnapshot(struct cpuState *cpu)
+{
+	pthread_mutex_lock(&snapshotLock);
+	snapshot = *cpu;
+	snapshotBase = memBase(cpu);
+	if ((snapshotCount = memAvailable(cpu, snapshotBase)) > 0) {
+		memcpy(snapshotMem, cpu->mem + snapshotBase, snapshotCount);
+	}
+	snapshotReady = 1;
+	pthread_mutex_unlock(&snapshotLock);
+}
+
+static void startUI()
+{
+	__atomic_store_n(&uiQuit, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&uiRequest, UI_SNAPSHOT, __ATOMIC_RELAXED);
+	nodelay(shell->wn, TRUE);
+
+	/*
+	 * Without the thread, the program still runs, only nothing is drawn
+	 * until it stops.
+	 */
+	if (pthread_create(&uiThread, NULL, uiLoop, NULL) != 0) {
+		shellPrint("Can't start the UI thread, running without live updates\n");
+		__atomic_store_n(&uiRequest, 0, __ATOMIC_RELAXED);
+		nodelay(shell->wn, FALSE);
+		return;
+	}
+	uiRunning = 1;
+	shellPrint("Running, press any key to pause\n");
+}
+
+static void stopUI()
+{
+	if (uiRunning == 0) {
+		return;
+	}
+
+	__atomic_store_n(&uiQuit, 1, __ATOMIC_RELEASE);
+	pthread_join(uiThread, NULL);
+	uiRunning = 0;
+	__atomic_store_n(&uiRequest, 0, __ATOMIC_RELAXED);
+	snapshotReady = 0;
+	nodelay(shell->wn, FALSE);
+
+	/*
+	 * Keys typed while running were meant to pause it, not as commands.
+	 */
+	flushinp();
+}
+
+int initTUI(int simple)
 {
+	pthread_mutexattr_t attr;
+
+	simpleTUI = simple;
+
 	/*
 	 * Must initialize a few signal handling variables.
 	 */
@@ -970,6 +1970,14 @@ int initTUI()
 		return 0;
 	}
 
+	/*
+	 * Recursive, drawing the code window may print to the shell.
+	 */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&screenLock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
     if ((top.wn = initscr()) == NULL) {
 		fprintf(stderr, "Error initialising ncurses.\n");
 		exit(1);
@@ -1023,6 +2031,28 @@ int initTUI()
 	mem = createWindow(&top, h, w, code->h, regs->w, "Memory");
 	box(mem->wn, 0, 0);
 
+	/*
+	 * As many bytes per line as fit, in a power of two: "ADDRESS  " then
+	 * 3 characters and 1 ASCII per byte, plus a space every 8 bytes.
+	 */
+	for (memWidth = 8; (memWidth < 64) && (8 + 2 + memWidth * 2 * 4 + memWidth * 2 / 8 <= mem->w - 2); memWidth *= 2) {
+	}
+	memLines = mem->h - 3;
+	memShown = calloc(memLines, memWidth);
+	memShownAddress = calloc(memLines, sizeof(*memShownAddress));
+	memShownCount = malloc(memLines * sizeof(*memShownCount));
+	snapshotMem = malloc(memLines * memWidth);
+	uiMem = malloc(memLines * memWidth);
+	if ((memShown == NULL) || (memShownAddress == NULL) || (memShownCount == NULL) ||
+		(snapshotMem == NULL) || (uiMem == NULL)) {
+		endwin();
+		fprintf(stderr, "Can't allocate memory window.\n");
+		exit(1);
+	}
+	for (i = 0; i < memLines; i++) {
+		memShownCount[i] = -1;
+	}
+
 	w = top.w;
 	y = code->h + regs->h;
 	h = top.h - y;
@@ -1042,10 +2072,16 @@ void freeTUI()
 		return;
 	}
 
+	stopUI();
 	deleteAllBreakpoints();
 
 	freeWindow(code);
 	freeWindow(mem);
+	free(memShown);
+	free(memShownAddress);
+	free(memShownCount);
+	free(snapshotMem);
+	free(uiMem);
 	freeWindow(regs);
 	freeWindow(shell);
 
@@ -1060,14 +2096,97 @@ void freeTUI()
     refresh();
 }
 
+void debuggerStop()
+{
+	keepGoing = 0;
+}
+
+int debuggerStops(struct cpuState *cpu, struct instruction *o)
+{
+	struct breakpoint *bp;
+	int stops = 0;
+
+	/*
+	 * Ignore counts are left out, they apply going forward.
+	 */
+	if (watch_hits != 0) {
+		watch_hits = 0;
+		for (bp = bp_list; bp != NULL; bp = bp->next) {
+			if (bp->watched) {
+				bp->watched = 0;
+				if (bp->expr == NULL || conditionEval(bp->expr, cpu, bp->hits + 1) != 0) {
+					stops = 1;
+				}
+			}
+		}
+		if (stops) {
+			return 1;
+		}
+	}
+
+	if (!breakpointAt(cpu->pc) && bp_finish_count == 0) {
+		return 0;
+	}
+	for (bp = bp_list; bp != NULL; bp = bp->next) {
+		if (reached(bp, cpu, o) &&
+			(bp->expr == NULL || conditionEval(bp->expr, cpu, bp->hits + 1) != 0)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int debuggerSkip(uint32_t pc)
+{
+	return keepGoing && !caughtSignal && bp_finish_count == 0 && watch_hits == 0 &&
+	       !__atomic_load_n(&uiRequest, __ATOMIC_RELAXED) && !breakpointAt(pc);
+}
+
 int updateTUI(struct cpuState *cpu, struct instruction *o)
 {
+	int request = 0;
+
+	if (uiRunning != 0) {
+		request = __atomic_exchange_n(&uiRequest, 0, __ATOMIC_ACQUIRE);
+	}
+	if (request & UI_SNAPSHOT) {
+		takeSnapshot(cpu);
+	}
+	if (request & UI_PAUSE) {
+		shellPrint("Paused\n");
+		keepGoing = 0;
+	}
+
+	if (checkForSignals() > 0) {
+		keepGoing = 0;
+	}
+
+	if (hitWatchpoint(cpu) != 0) {
+		keepGoing = 0;
+	}
+
+	if (hitBreakpoint(cpu, o) != 0) {
+		keepGoing = 0;
+	}
+
+	/*
+	 * While running, only the UI thread draws.
+	 */
+	if (keepGoing != 0) {
+		return 0;
+	}
+
 	if (simpleTUI != 0) {
 		updateSimple(cpu, o);
 	} else {
+		stopUI();
 		updateCodeWindow(code, cpu->pc);
 		updateRegsWindow(regs, cpu);
+		showMemory(cpu);
 		updateShellWindow(shell, cpu, o);
+		if (keepGoing != 0) {
+			startUI();
+		}
 	}
 
 	return 0;
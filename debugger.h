@@ -1,12 +1,15 @@
 #ifndef __DEBUGGER_H
 #define __DEBUGGER_H
 
+#include <stdio.h>
+
 #include "cpu.h"
 
 /*
- * Initialize and free the Text User Interface (TUI).
+ * Initialize and free the Text User Interface (TUI). With 'simple', the
+ * debugger reads commands from stdin and prints to stdout instead.
  */
-int initTUI();
+int initTUI(int simple);
 void freeTUI();
 
 /*
@@ -14,11 +17,58 @@ void freeTUI();
  */
 int loadDebugInfo(char *fileName, uint32_t baseAddr);
 
+/*
+ * Map a program offset back to the source file and line it came from.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int mapOffsetToLine(uint32_t progOffset, char **file, int *lineNum);
+
+/*
+ * Watched guest memory: one bit per WATCH_PAGE_SIZE page of the 32 bit
+ * address space, NULL while there are no watchpoints. Accesses touching
+ * a marked page must be passed to debuggerWatch() with the PC of the
+ * accessing instruction, which stops execution before the next
+ * instruction if they hit a watchpoint.
+ */
+#define WATCH_PAGE_SHIFT 12
+#define WATCH_PAGE_SIZE  (1 << WATCH_PAGE_SHIFT)
+#define WATCH_PAGES      (1 << (32 - WATCH_PAGE_SHIFT))
+
+extern uint8_t *watchPages;
+
+void debuggerWatch(uint32_t pc, uint32_t address, uint32_t size, int write);
+
+/*
+ * Returns 1 while continuing with no breakpoint at 'pc', when
+ * updateTUI() has nothing to do for this instruction.
+ */
+int debuggerSkip(uint32_t pc);
+
+/*
+ * Stop at the next instruction even while continuing.
+ */
+void debuggerStop();
+
+/*
+ * Returns 1 if a breakpoint or a watchpoint hit by the last instruction
+ * would stop the program before 'o', without counting the hit. Reverse
+ * execution uses it while running forward again.
+ */
+int debuggerStops(struct cpuState *cpu, struct instruction *o);
+
 /*
  * Update the TUI and dump CPU state.
  */
 int updateTUI(struct cpuState *cpu, struct instruction *o);
 void dumpRegisters(struct cpuState *cpu, char *message, int printHeader);
-void dumpMemory(struct cpuState *cpu, int width);
+
+/*
+ * Hex dump 'length' bytes from 'start', 'width' bytes per line, to
+ * 'stream' or to the shell when it is NULL. Runs of identical lines are
+ * collapsed into one "*".
+ */
+void dumpMemory(struct cpuState *cpu, uint32_t start, uint32_t length, int width, FILE *stream);
 
 #endif /* __DEBUGGER_H */
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "dma.h"
+#include "reverse.h"
+
+static struct cpuState *dmaCPU;
+
+static uint32_t source;
+static uint32_t destination;
+static uint32_t length;
+static uint32_t mode;
+static uint32_t status;
+
+/*
+ * Overlapping copies to a higher address run from the end, so the
+ * result is the same as one memmove.
+ */
+static int backwards;
+
+void dmaInit(struct cpuState *cpu)
+{
+	dmaCPU = cpu;
+}
+
+static void finish(uint32_t result)
+{
+	status = result;
+	dmaCPU->intPending |= 1 << INT_DMA;
+}
+
+static void start()
+{
+	if (status & DMA_BUSY) {
+		return;
+	}
+
+	if (!isMemory(dmaCPU, destination, length) ||
+		((mode == DMA_MODE_COPY) && !isMemory(dmaCPU, source, length)) ||
+		(mode != DMA_MODE_COPY && mode != DMA_MODE_FILL)) {
+		finish(DMA_DONE | DMA_ERROR);
+		return;
+	}
+
+	backwards = (mode == DMA_MODE_COPY) && (destination > source) &&
+	            (destination < source + length);
+	status = DMA_BUSY;
+
+	/*
+	 * The first chunk moves right away, a short transfer is then done
+	 * by the time the guest looks at the status.
+	 */
+	dmaTick();
+}
+
+uint32_t dmaRead(uint32_t offset)
+{
+	switch (offset & ~0x3) {
+		case DMA_SOURCE:
+			return source;
+		case DMA_DESTINATION:
+			return destination;
+		case DMA_LENGTH:
+			return length;
+		case DMA_MODE:
+			return mode;
+		default:
+			return status;
+	}
+}
+
+void dmaWrite(uint32_t offset, uint32_t data)
+{
+	/*
+	 * The address registers are read only during a transfer.
+	 */
+	if ((status & DMA_BUSY) && ((offset & ~0x3) != DMA_CONTROL)) {
+		return;
+	}
+
+	switch (offset & ~0x3) {
+		case DMA_SOURCE:
+			source = data;
+			break;
+		case DMA_DESTINATION:
+			destination = data;
+			break;
+		case DMA_LENGTH:
+			length = data;
+			break;
+		case DMA_MODE:
+			mode = data;
+			break;
+		default:
+			if (data & DMA_START) {
+				start();
+			} else if ((status & DMA_BUSY) == 0) {
+				status = 0;
+			}
+			break;
+	}
+}
+
+int dmaBusy()
+{
+	return (status & DMA_BUSY) != 0;
+}
+
+void dmaTick()
+{
+	uint32_t n = length < DMA_CHUNK ? length : DMA_CHUNK;
+	uint8_t *mem = dmaCPU->mem;
+
+	reverseWriteRange(backwards ? destination + length - n : destination, n);
+	if (mode == DMA_MODE_FILL) {
+		memset(mem + destination, source & 0xFF, n);
+	} else if (backwards) {
+		memmove(mem + destination + length - n, mem + source + length - n, n);
+	} else {
+		memmove(mem + destination, mem + source, n);
+	}
+
+	if (!backwards) {
+		destination += n;
+		if (mode == DMA_MODE_COPY) {
+			source += n;
+		}
+	}
+	length -= n;
+
+	if (length == 0) {
+		finish(DMA_DONE);
+	}
+}
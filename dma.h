@@ -0,0 +1,54 @@
+#ifndef __DMA_H
+#define __DMA_H
+
+#include "cpu.h"
+
+/*
+ * DMA engine registers, relative to the memory mapped I/O region.
+ *
+ * A transfer moves (or fills) Length bytes from Source to Destination,
+ * both absolute addresses, when Control is written with DMA_START. Fill
+ * mode writes the low byte of Source. Source, Destination and Length
+ * advance as the transfer proceeds. On completion Status reads DMA_DONE
+ * and the INT_DMA interrupt becomes pending.
+ */
+#define DMA_BASE         0xA8
+#define DMA_SIZE         0x14
+
+#define DMA_SOURCE       0x0
+#define DMA_DESTINATION  0x4
+#define DMA_LENGTH       0x8
+#define DMA_MODE         0xC
+#define DMA_CONTROL      0x10
+
+#define DMA_MODE_COPY    0x0
+#define DMA_MODE_FILL    0x1
+
+#define DMA_START        0x1
+
+#define DMA_BUSY         0x1
+#define DMA_DONE         0x2
+#define DMA_ERROR        0x4
+
+/*
+ * Bytes moved per emulated instruction.
+ */
+#define DMA_CHUNK        256
+
+void dmaInit(struct cpuState *cpu);
+
+uint32_t dmaRead(uint32_t offset);
+void dmaWrite(uint32_t offset, uint32_t data);
+
+/*
+ * Returns 1 while a transfer is in progress.
+ */
+int dmaBusy();
+
+/*
+ * Move the next chunk of the current transfer. Called once per
+ * instruction while busy.
+ */
+void dmaTick();
+
+#endif /* __DMA_H */
@@ -1,6 +1,8 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <inttypes.h>
 #include <errno.h>
 #include <sys/stat.h>
@@ -13,6 +15,22 @@
 #include "isa.h"
 #include "cpu.h"
 #include "debugger.h"
+#include "symbols.h"
+#include "trace.h"
+#include "coverage.h"
+#include "profile.h"
+#include "timing.h"
+#include "cache.h"
+#include "bpred.h"
+#include "pipeline.h"
+#include "idle.h"
+#include "hooks.h"
+#include "dma.h"
+#include "block.h"
+#include "console.h"
+#include "spi.h"
+#include "reverse.h"
+#include "gdb.h"
 
 #define log(...) \
 	do { \
@@ -30,7 +48,32 @@ static struct binary *gBinaryList;
 
 static int		beInteractive;
 static int		tui;
+static char		*gdbConfig;
+static int		gdbing;
 static char		*romFile;
+static char		*traceFile;
+static char		*coverageFile;
+static uint8_t	*coverageMap;
+static long		profileInterval;
+static int		timing;
+static char		*timingFile;
+static double	clockHz = 100e6;
+static char		*cacheConfig[2];
+static int		caching;
+static char		*bpredConfig;
+static int		pipelining;
+static char		*pipelineConfig;
+static int		fastForward;
+static int		hooking;
+static char		*hooksMode;
+static char		*diskConfig;
+static int		consoling;
+static char		*consoleConfig;
+static char		*spiConfig[SPI_SLAVES];
+static int		numSpiConfigs;
+static int		reversing;
+static char		*reverseConfig;
+static int		wantDebugInfo;
 
 static struct cpuState cpu;
 
@@ -189,6 +232,56 @@ static int loadBinary(struct binary *binary)
 	return 0;
 }
 
+/*
+ * Load the labels exported next to a binary, i.e. foo.bin -> foo.sym.
+ */
+static void loadSymbols(struct binary *binary)
+{
+	char		*symbolFile;
+	char		*textFile;
+	char		*marker;
+	struct stat	statBuffer;
+	struct stat	dbiStat;
+	struct stat	textStat;
+	int			len;
+
+	if ((marker = strrchr(binary->filePath, '.')) == NULL) {
+		return;
+	}
+	len = (uintptr_t)marker - (uintptr_t)binary->filePath;
+	if (stat(binary->filePath, &statBuffer) != 0) {
+		return;
+	}
+
+	if (asprintf(&textFile, "%.*s.sym", len, binary->filePath) < 0) {
+		return;
+	}
+
+	/*
+	 * Binary debug info has the same symbols and needs no parsing, unless
+	 * it is older than the .sym file.
+	 */
+	if (asprintf(&symbolFile, "%.*s.dbi", len, binary->filePath) < 0) {
+		free(textFile);
+		return;
+	}
+	if ((stat(symbolFile, &dbiStat) == 0) && (access(symbolFile, R_OK) == 0) &&
+		((stat(textFile, &textStat) != 0) || (dbiStat.st_mtime >= textStat.st_mtime)) &&
+		(symbolsLoadDebug(symbolFile, binary->memoryOffset + statBuffer.st_size) == 0)) {
+		free(symbolFile);
+		free(textFile);
+		return;
+	}
+	free(symbolFile);
+	symbolFile = textFile;
+
+	if (access(symbolFile, R_OK) == 0) {
+		symbolsLoad(symbolFile, binary->memoryOffset + statBuffer.st_size);
+	}
+
+	free(symbolFile);
+}
+
 static void parse8bit(char *bits, uint8_t *memory)
 {
 	*(uint8_t *)memory = (uint8_t)strtoul(bits, NULL, 2);
@@ -243,11 +336,91 @@ static int loadROM(char *path)
 	return(returnValue);
 }
 
+/*
+ * Write the executed instruction bitmap for the `coverage` tool.
+ */
+static int dumpCoverage()
+{
+	FILE *f;
+	struct coverageHeader header;
+
+	if ((f = fopen(coverageFile, "w")) == NULL) {
+		fprintf(stderr, "Can't open %s: %s\n", coverageFile, strerror(errno));
+		return(-1);
+	}
+
+	header.magic = COVERAGE_MAGIC;
+	header.memSize = cpu.memSize;
+	if ((fwrite(&header, sizeof(header), 1, f) != 1) ||
+		(fwrite(coverageMap, 1, coverageBytes(cpu.memSize), f) != coverageBytes(cpu.memSize))) {
+		fprintf(stderr, "Can't write %s: %s\n", coverageFile, strerror(errno));
+		fclose(f);
+		return(-1);
+	}
+	fclose(f);
+
+	return(0);
+}
+
 static void freeEnvironment()
 {
-	if (tui != 0) {
+	blockClose();
+	consoleClose();
+	spiClose(stderr);
+
+	if (profileInterval != 0) {
+		profileStop(stderr);
+	}
+
+	if (timing != 0) {
+		timingReport(stderr, cpu.ic, clockHz);
+	}
+
+	if (caching != 0) {
+		cacheReport(stderr);
+		cacheFree();
+	}
+
+	if (bpredConfig != NULL) {
+		bpredReport(stderr);
+		bpredFree();
+	}
+
+	if (pipelining != 0) {
+		pipelineReport(stderr);
+		pipelineFree();
+	}
+
+	if (fastForward != 0) {
+		idleReport(stderr);
+	}
+
+	if (hooking != 0) {
+		hooksReport(stderr);
+		hooksFree();
+	}
+
+	if (traceFile != NULL) {
+		traceClose(cpu.ic);
+	}
+
+	if (coverageMap != NULL) {
+		dumpCoverage();
+		free(coverageMap);
+		coverageMap = NULL;
+	}
+
+	if (reversing != 0) {
+		reverseFree();
+	}
+
+	if (beInteractive != 0) {
 		freeTUI();
 	}
+	if (gdbing != 0) {
+		gdbClose();
+	}
+	symbolsFree();
 
 	if (cpu.mem != NULL) {
 		if (munmap(cpu.mem, cpu.memSize) != 0) {
@@ -266,11 +439,19 @@ static void freeEnvironment()
 	}
 }
 
+static int peekMemory(uint32_t address, uint32_t size, uint32_t *value);
+
 static int initEnvironment()
 {
+	int i;
+
 	cpu.pc = 0;
-	cpu.mmapIOstart = 0;
-	cpu.mmapIOend = 0; //0x9C
+	cpu.mmapIOstart = MMAP_IO_START;
+	cpu.mmapIOend = MMAP_IO_START + MMAP_IO_SIZE;
+	dmaInit(&cpu);
+	blockInit(&cpu);
+	consoleInit(&cpu);
+	spiInit(&cpu);
 	cpu.maxCycles = UINT64_MAX;
 	cpu.memSize = 32 * 1024 * 1024;
 	cpu.memoryFile = "emulator.memory";
@@ -303,14 +484,108 @@ static int initEnvironment()
 			if (loadBinary(thisBinary) < 0) {
 				return(1);
 			}
-			if (tui != 0) {
+			loadSymbols(thisBinary);
+			if (wantDebugInfo != 0) {
 				loadDebugInfo(thisBinary->filePath, thisBinary->memoryOffset);
 			}
 		}
 	}
 
-	if (tui != 0) {
-		initTUI();
+	if ((diskConfig != NULL) && (blockOpen(diskConfig) < 0)) {
+		return(1);
+	}
+
+	if ((consoling != 0) && (consoleOpen(consoleConfig) < 0)) {
+		return(1);
+	}
+
+	for (i = 0; i < numSpiConfigs; i++) {
+		if (spiAttach(spiConfig[i]) < 0) {
+			return(1);
+		}
+	}
+	if ((consoling != 0) && ((beInteractive != 0) || (tui != 0)) && consoleUsesTerminal()) {
+		fprintf(stderr, "The console can't share the terminal with the debugger, give it files.\n");
+		return(1);
+	}
+
+	if ((traceFile != NULL) && (traceOpen(traceFile) < 0)) {
+		return(1);
+	}
+
+	if ((timing != 0) && (timingInit(timingFile) < 0)) {
+		return(1);
+	}
+
+	if (((cacheConfig[CACHE_INST] != NULL) && (cacheInit(CACHE_INST, cacheConfig[CACHE_INST]) < 0)) ||
+		((cacheConfig[CACHE_DATA] != NULL) && (cacheInit(CACHE_DATA, cacheConfig[CACHE_DATA]) < 0))) {
+		return(1);
+	}
+	caching = (cacheConfig[CACHE_INST] != NULL) || (cacheConfig[CACHE_DATA] != NULL);
+
+	if ((bpredConfig != NULL) && (bpredInit(bpredConfig) < 0)) {
+		return(1);
+	}
+
+	if ((pipelining != 0) && (pipelineInit(pipelineConfig) < 0)) {
+		return(1);
+	}
+
+	if ((gdbing != 0) && (beInteractive != 0)) {
+		fprintf(stderr, "gdb and the built-in debugger (-i or -t) can't be used together.\n");
+		return(1);
+	}
+
+	/*
+	 * Skipping loops would hide instructions from the debugger and the
+	 * models, which all need to see every one of them.
+	 */
+	if ((fastForward != 0) &&
+		((beInteractive != 0) || (gdbing != 0) || (traceFile != NULL) || (profileInterval != 0) ||
+		 (timing != 0) || (caching != 0) || (bpredConfig != NULL) || (pipelining != 0))) {
+		fprintf(stderr, "Fast-forward is disabled by interactive mode, gdb and models.\n");
+		fastForward = 0;
+	}
+	if (fastForward != 0) {
+		idleInit(peekMemory);
+	}
+
+	if ((hooking != 0) &&
+		((beInteractive != 0) || (gdbing != 0) || (traceFile != NULL) || (coverageFile != NULL) ||
+		 (profileInterval != 0) || (timing != 0) || (caching != 0) ||
+		 (bpredConfig != NULL) || (pipelining != 0))) {
+		fprintf(stderr, "Native hooks are disabled by interactive mode, gdb, coverage and models.\n");
+		hooking = 0;
+	}
+	if ((hooking != 0) &&
+		(hooksInit(&cpu, (hooksMode != NULL) && (strcmp(hooksMode, "verify") == 0)) < 0)) {
+		return(1);
+	}
+
+	if ((reversing != 0) && (beInteractive == 0)) {
+		fprintf(stderr, "Reverse execution needs the debugger (-i or -t).\n");
+		reversing = 0;
+	}
+	if ((reversing != 0) && (reverseInit(&cpu, reverseConfig) < 0)) {
+		return(1);
+	}
+
+	if ((coverageFile != NULL) &&
+		((coverageMap = calloc(1, coverageBytes(cpu.memSize))) == NULL)) {
+		fprintf(stderr, "Can't allocate coverage map: %s\n", strerror(errno));
+		return(1);
+	}
+
+	if (beInteractive != 0) {
+		initTUI(tui == 0);
+	}
+
+	if ((gdbing != 0) && (gdbOpen(&cpu, gdbConfig) < 0)) {
+		return(1);
+	}
+
+	if ((profileInterval != 0) && (profileStart(&cpu, profileInterval) < 0)) {
+		return(1);
 	}
 
 	return 0;
@@ -353,26 +628,57 @@ static void interactive()
 		return;
 	}
 
-	fetchInst(cpu.pc, &o);
+	/*
+	 * A reverse command rewinds the state and runs forward again without
+	 * the debugger, which only sees where it ends.
+	 */
+	do {
+		while (reverseActive()) {
+			fetchInst(cpu.pc, &o);
+			if (reverseReplay(debuggerStops(&cpu, &o)) != 0) {
+				return;
+			}
+		}
+
+		if (debuggerSkip(cpu.pc)) {
+			return;
+		}
+
+		fetchInst(cpu.pc, &o);
 
-	updateTUI(&cpu, &o);
+		updateTUI(&cpu, &o);
+	} while (reverseActive());
 }
 
-#if 0
-struct SPI {
-	uint8_t tx, rx;
-};
-
-static int SPIsend(uint8_t data)
+/*
+ * The program stopped. The debugger gets a last look and going back from
+ * there runs it again.
+ *
+ * Returns 1 if execution goes on.
+ */
+static int finished(int *stop)
 {
-	return(0);
+	if (reversing != 0) {
+		debuggerStop();
+	}
+	interactive();
+	if (!reverseActive()) {
+		return 0;
+	}
+	*stop = 0;
+	return 1;
 }
 
-static uint8_t SPIrecv()
+/*
+ * Jump target as "label+0xOFFSET" for the instruction log.
+ */
+static char *symbolize(uint32_t address)
 {
-	return(0);
+	static char buf[256];
+
+	symbolsFormat(address, buf, sizeof(buf));
+	return buf;
 }
-#endif
 
 static uint32_t getAddress(uint8_t mode, uint32_t offset)
 {
@@ -389,6 +695,39 @@ static uint32_t getAddress(uint8_t mode, uint32_t offset)
 	}
 }
 
+/*
+ * Memory mapped devices whose registers have side effects. Accesses to
+ * their range go to the device instead of mmapIOregister().
+ */
+struct mmioDevice {
+	uint32_t start;
+	uint32_t size;
+	uint32_t (*read)(uint32_t offset);
+	void (*write)(uint32_t offset, uint32_t data);
+};
+
+static struct mmioDevice mmioDevices[] = {
+	{SPI_BASE, SPI_SIZE, spiRead, spiWrite},
+	{DMA_BASE, DMA_SIZE, dmaRead, dmaWrite},
+	{BLOCK_BASE, BLOCK_SIZE, blockRead, blockWrite},
+	{CONSOLE_BASE, CONSOLE_SIZE, consoleRead, consoleWrite},
+	{SPI_BURST_BASE, SPI_BURST_SIZE, spiBurstRead, spiBurstWrite},
+};
+
+static struct mmioDevice *mmioDevice(uint32_t address)
+{
+	int i;
+
+	for (i = 0; i < sizeof(mmioDevices) / sizeof(*mmioDevices); i++) {
+		if (address >= mmioDevices[i].start &&
+			address < mmioDevices[i].start + mmioDevices[i].size) {
+			return &mmioDevices[i];
+		}
+	}
+
+	return(NULL);
+}
+
 static  uint32_t *mmapIOregister(uint32_t address)
 {
 	if (address >= 0x0 && address < 0x4) {
@@ -410,7 +749,7 @@ static  uint32_t *mmapIOregister(uint32_t address)
 		return &cpu.intControl;
 	}
 	if (address >= 0xC && address < 0x8C) {
-		int i = (0xC - address) / 4;
+		int i = (address - 0xC) / 4;
 		/*
 		 * Interrupt Handler Vector
 		 */
@@ -453,21 +792,92 @@ static inline void isValidAddress(uint32_t address)
 	}
 }
 
+/*
+ * Let reverse execution save pages before their first write since the
+ * last checkpoint.
+ */
+static inline void reverseWrite(uint32_t address, uint32_t size)
+{
+	uint32_t first = address >> REVERSE_PAGE_SHIFT;
+	uint32_t last = (address + size - 1) >> REVERSE_PAGE_SHIFT;
+
+	if (((reverseSaved[first / 8] >> (first % 8)) & 1) == 0) {
+		reverseSavePage(first);
+	}
+	if (((reverseSaved[last / 8] >> (last % 8)) & 1) == 0) {
+		reverseSavePage(last);
+	}
+}
+
+/*
+ * Let the debugger or gdb see accesses to pages with watchpoints.
+ */
+static inline void watchAccess(uint32_t address, uint32_t size, int write)
+{
+	uint32_t first = address >> WATCH_PAGE_SHIFT;
+	uint32_t last = (address + size - 1) >> WATCH_PAGE_SHIFT;
+
+	if (((watchPages[first / 8] >> (first % 8)) & 1) ||
+		((watchPages[last / 8] >> (last % 8)) & 1)) {
+		if (gdbing != 0) {
+			gdbWatch(address, size, write);
+		} else {
+			debuggerWatch(cpu.pc, address, size, write);
+		}
+	}
+}
+
 static uint8_t read8bit(uint32_t address)
 {
 	isValidAddress(address);
 
-	return cpu.mem[address];
+	if (watchPages != NULL) {
+		watchAccess(address, 1, 0);
+	}
+
+	if (address < cpu.mmapIOstart || address >= cpu.mmapIOend) {
+		if (caching != 0) {
+			cacheAccess(CACHE_DATA, address, 1, 0);
+		}
+		return cpu.mem[address];
+	}
+
+	/*
+	 * A byte of a memory mapped register, in little endian order.
+	 */
+	address -= cpu.mmapIOstart;
+
+	struct mmioDevice *device = mmioDevice(address);
+
+	if (device != NULL) {
+		return(device->read(address - device->start) >> (8 * (address & 0x3)));
+	}
+
+	uint32_t *reg = mmapIOregister(address);
+
+	if (reg == NULL) {
+		fprintf(stderr, "Can't get memory mapped register to read.\n");
+		exit(1);
+	}
+
+	return(*reg >> (8 * (address & 0x3)));
 }
 
 static uint32_t read32bit(uint32_t address)
 {
 	isValidAddress(address + 3);
 
+	if (watchPages != NULL) {
+		watchAccess(address, 4, 0);
+	}
+
 	if (address < cpu.mmapIOstart || address >= cpu.mmapIOend) {
 		/*
 		 * Normal memory access.
 		 */
+		if (caching != 0) {
+			cacheAccess(CACHE_DATA, address, 4, 0);
+		}
 		return *(uint32_t *)(cpu.mem + address);
 	}
 
@@ -476,6 +886,12 @@ static uint32_t read32bit(uint32_t address)
 	 */
 	address -= cpu.mmapIOstart;
 
+	struct mmioDevice *device = mmioDevice(address);
+
+	if (device != NULL) {
+		return(device->read(address - device->start));
+	}
+
 	uint32_t *reg = mmapIOregister(address);
 
 	if (reg == NULL) {
@@ -490,17 +906,63 @@ static void write8bit(uint32_t address, uint8_t data)
 {
 	isValidAddress(address);
 
-	cpu.mem[address] = data;
+	if (watchPages != NULL) {
+		watchAccess(address, 1, 1);
+	}
+
+	if (address < cpu.mmapIOstart || address >= cpu.mmapIOend) {
+		if (caching != 0) {
+			cacheAccess(CACHE_DATA, address, 1, 1);
+		}
+		if (reverseSaved != NULL) {
+			reverseWrite(address, 1);
+		}
+		cpu.mem[address] = data;
+
+		return;
+	}
+
+	/*
+	 * Devices get the byte as the whole register value, so that stb
+	 * works for data registers like the console's. Plain registers only
+	 * change in the byte written.
+	 */
+	address -= cpu.mmapIOstart;
+
+	struct mmioDevice *device = mmioDevice(address);
+
+	if (device != NULL) {
+		device->write(address - device->start, data);
+		return;
+	}
+
+	uint32_t *reg = mmapIOregister(address);
+
+	if (reg == NULL) {
+		fprintf(stderr, "Can't get memory mapped register to write.\n");
+		exit(1);
+	}
+	*reg = (*reg & ~(0xFFu << (8 * (address & 0x3)))) | ((uint32_t)data << (8 * (address & 0x3)));
 }
 
 static void write32bit(uint32_t address, uint32_t data)
 {
 	isValidAddress(address + 3);
 
+	if (watchPages != NULL) {
+		watchAccess(address, 4, 1);
+	}
+
 	if (address < cpu.mmapIOstart || address >= cpu.mmapIOend) {
 		/*
 		 * Normal memory access.
 		 */
+		if (caching != 0) {
+			cacheAccess(CACHE_DATA, address, 4, 1);
+		}
+		if (reverseSaved != NULL) {
+			reverseWrite(address, 4);
+		}
 		*(uint32_t *)(cpu.mem + address) = data;
 
 		return;
@@ -511,6 +973,13 @@ static void write32bit(uint32_t address, uint32_t data)
 	 */
 	address -= cpu.mmapIOstart;
 
+	struct mmioDevice *device = mmioDevice(address);
+
+	if (device != NULL) {
+		device->write(address - device->start, data);
+		return;
+	}
+
 	uint32_t *reg = mmapIOregister(address);
 
 	if (reg == NULL) {
@@ -520,6 +989,167 @@ static void write32bit(uint32_t address, uint32_t data)
 	*reg = data;
 }
 
+/*
+ * When a timer's counter register reaches its terminal count, the
+ * counter restarts from zero and the timer's interrupt becomes pending.
+ */
+static void updateTimers()
+{
+	if ((cpu.timerControl1 & TIMER_ENABLE) &&
+		(cpu.r[R_C1] >= cpu.timerTerminalCount1)) {
+		cpu.r[R_C1] = 0;
+		cpu.intPending |= 1 << INT_TIMER1;
+	}
+	if ((cpu.timerControl2 & TIMER_ENABLE) &&
+		(cpu.r[R_C2] >= cpu.timerTerminalCount2)) {
+		cpu.r[R_C2] = 0;
+		cpu.intPending |= 1 << INT_TIMER2;
+	}
+}
+
+/*
+ * Enter the handler of the lowest numbered pending and enabled interrupt.
+ *
+ * The handler is called like any other function: the interrupted PC is
+ * pushed onto the stack (relative to ba) and the handler returns with
+ * the usual "ldw r4 sp; add sp sp 4; jmp r4". Interrupts are globally
+ * disabled until the handler enables them again.
+ */
+static void dispatchInterrupt()
+{
+	uint32_t active;
+	int i;
+
+	if ((cpu.intGlobalControl & INT_GLOBAL_ENABLE) == 0) {
+		return;
+	}
+	if ((active = cpu.intPending & cpu.intControl) == 0) {
+		return;
+	}
+	i = ffs(active) - 1;
+
+	cpu.intPending &= ~(1 << i);
+	cpu.intGlobalControl &= ~INT_GLOBAL_ENABLE;
+
+	cpu.r[R_SP] -= 4;
+	write32bit(getAddress(ADDR_REL, cpu.r[R_SP]), hostToLittle32(cpu.pc - cpu.r[R_BA]));
+	cpu.pc = cpu.intVector[i];
+
+	if (traceFile != NULL) {
+		traceInterrupt(cpu.ic, i);
+	}
+}
+
+/*
+ * Read guest memory for the idle loop analysis, as ldb and ldw would but
+ * without touching the cache model.
+ */
+static int peekMemory(uint32_t address, uint32_t size, uint32_t *value)
+{
+	uint32_t *reg;
+
+	if ((address + size - 1) >= cpu.memSize || (address + size - 1) < address) {
+		return(-1);
+	}
+
+	if (address < cpu.mmapIOstart || address >= cpu.mmapIOend) {
+		if (size == 1) {
+			*value = cpu.mem[address];
+		} else {
+			*value = littleToHost32(*(uint32_t *)(cpu.mem + address));
+		}
+		return(0);
+	}
+
+	/*
+	 * Device registers may change on their own or on being read.
+	 */
+	if ((mmioDevice(address - cpu.mmapIOstart) != NULL) ||
+		((reg = mmapIOregister(address - cpu.mmapIOstart)) == NULL)) {
+		return(-1);
+	}
+	*value = littleToHost32(*reg);
+	if (size == 1) {
+		*value = (*value >> (8 * (address & 0x3))) & 0xFF;
+	}
+
+	return(0);
+}
+
+/*
+ * Number of instructions that can retire before anything but the guest's
+ * own instructions changes the machine state: an interrupt being taken,
+ * a device at work, a timer reaching its terminal count or the cycle
+ * limit running out.
+ */
+static uint64_t quietInstructions()
+{
+	uint64_t n = cpu.maxCycles;
+
+	if ((cpu.intGlobalControl & INT_GLOBAL_ENABLE) &&
+		(cpu.intPending & cpu.intControl)) {
+		return(0);
+	}
+	if (dmaBusy() || blockBusy() || consoleBusy() || spiBusy()) {
+		return(0);
+	}
+	if (cpu.timerControl1 & TIMER_ENABLE) {
+		if (cpu.r[R_C1] + 1 >= cpu.timerTerminalCount1) {
+			return(0);
+		}
+		if (cpu.timerTerminalCount1 - 1 - cpu.r[R_C1] < n) {
+			n = cpu.timerTerminalCount1 - 1 - cpu.r[R_C1];
+		}
+	}
+	if (cpu.timerControl2 & TIMER_ENABLE) {
+		if (cpu.r[R_C2] + 1 >= cpu.timerTerminalCount2) {
+			return(0);
+		}
+		if (cpu.timerTerminalCount2 - 1 - cpu.r[R_C2] < n) {
+			n = cpu.timerTerminalCount2 - 1 - cpu.r[R_C2];
+		}
+	}
+
+	return(n);
+}
+
+/*
+ * Account for 'n' instructions retired without going through the main
+ * loop: the instruction count, the cycle counters and their timers and
+ * the cycle limit all move as if they had been executed.
+ */
+static void advanceCounters(uint64_t n)
+{
+	cpu.ic += n;
+	cpu.maxCycles -= n;
+	cpu.r[R_C1] += n;
+	cpu.r[R_C2] += n;
+	if ((cpu.timerControl1 | cpu.timerControl2) != 0) {
+		updateTimers();
+	}
+}
+
+/*
+ * The branch at 'branchPC' just jumped back to the PC. If the loop it
+ * closes is only waiting, jump ahead to its last iterations.
+ */
+static void skipIdleLoop(uint32_t branchPC)
+{
+	uint32_t pc;
+	uint64_t n;
+
+	if ((n = idleSkip(&cpu, branchPC, quietInstructions())) == 0) {
+		return;
+	}
+	advanceCounters(n);
+
+	if (coverageMap != NULL) {
+		for (pc = cpu.pc; pc <= branchPC; pc += 8) {
+			coverageMark(coverageMap, pc);
+		}
+	}
+}
+
 static struct option longopts[] = {
 	{"rom", required_argument, NULL, 'r'},
 	{"binary", required_argument, NULL, 'b'},
@@ -528,16 +1158,50 @@ static struct option longopts[] = {
 	{"interactive", no_argument, NULL, 'i'},
 	{"tui", no_argument, NULL, 't'},
 	{"starting-pc", required_argument, NULL, 'p'},
-	{"help", no_argument, NULL, 'h'}
+	{"trace", required_argument, NULL, 'T'},
+	{"coverage", required_argument, NULL, 'C'},
+	{"profile", required_argument, NULL, 'P'},
+	{"timing", optional_argument, NULL, 'k'},
+	{"clock", required_argument, NULL, 'H'},
+	{"icache", required_argument, NULL, 'I'},
+	{"dcache", required_argument, NULL, 'D'},
+	{"bpred", required_argument, NULL, 'B'},
+	{"pipeline", optional_argument, NULL, 'L'},
+	{"fast-forward", no_argument, NULL, 'F'},
+	{"hooks", optional_argument, NULL, 'N'},
+	{"disk", required_argument, NULL, 'S'},
+	{"console", optional_argument, NULL, 'U'},
+	{"spi", required_argument, NULL, 'Q'},
+	{"reverse", optional_argument, NULL, 'R'},
+	{"gdb", required_argument, NULL, 'G'},
+	{"help", no_argument, NULL, 'h'},
+	{NULL, 0, NULL, 0}
 };
 
 static char *optdesc[] = {
 	"The ROM to load into memory.",
 	"A binary to place in memory as <binaryPath>:<memoryOffset>.",
+	"Debug info for a binary as <binaryPath>:<memoryOffset>, from its .dbi or .debug file.",
 	"Emulator will exit after N cycles.",
 	"Interactive debugging mode.",
 	"Text user interface (TUI).",
 	"Starting program counter value as <memoryOffset>.",
+	"Write a Chrome trace_event timeline of guest calls to a file.",
+	"Write a bitmap of executed instructions to a file.",
+	"Sample the guest PC every N microseconds and report hot spots.",
+	"Count clock cycles of hdl/cpu.v, optionally from a cycle table file.",
+	"Clock frequency in Hz used to estimate wall time (default 100MHz).",
+	"Simulate an instruction cache as <size>:<ways>:<line>[:<policy>[:<penalty>]].",
+	"Simulate a data cache as <size>:<ways>:<line>[:<policy>[:<penalty>]].",
+	"Simulate a branch predictor: static, bimodal[:<bits>] or gshare[:<bits>].",
+	"Model a 5 stage pipeline, optionally as noforward,flush=<n>.",
+	"Skip ahead over loops that only wait on counters, timers or memory.",
+	"Run lib memcpy/memset/strlen/strcpy natively, =verify to check them.",
+	"Serve the block device from a disk image as <imagePath>[,async|uring|pool].",
+	"Connect the console device as [<outputPath>][,<inputPath>] (- is stdout/stdin).",
+	"Attach an SPI slave on the next select line: sd=<imagePath> or lcd[=<pbmPath>].",
+	"Keep checkpoints for the debugger's rs/rc as [<interval>][,<budget MB>].",
+	"Serve the GDB remote protocol on unix:<path> or tcp:<host>:<port>.",
 	"This help."
 };
 
@@ -551,7 +1215,7 @@ static void usage(int argc, char **argv)
 
 	printf("%s [OPTION...]\n\n", argv[0]);
 
-	numOptions = sizeof(longopts) / sizeof(*longopts);
+	numOptions = sizeof(longopts) / sizeof(*longopts) - 1;
 	longest = 0;
 	for (i = 0; i < numOptions; ++i) {
 		if (longest < strlen(longopts[i].name)) {
@@ -570,7 +1234,7 @@ static void parseArgs(int argc, char **argv)
 	int longindex;
 	int numOptions;
 
-	numOptions = sizeof(longopts) / sizeof(*longopts);
+	numOptions = sizeof(longopts) / sizeof(*longopts) - 1;
 	optstring = malloc(numOptions * 3);
 	memset(optstring, 0, numOptions * 3);
 
@@ -599,6 +1263,7 @@ static void parseArgs(int argc, char **argv)
 			case 't':
 				beInteractive = 1;
 				tui = 1;
+				wantDebugInfo = 1;
 				break;
 			case 'c':
 				cpu.maxCycles = strtoull(optarg, NULL, 0);
@@ -606,6 +1271,66 @@ static void parseArgs(int argc, char **argv)
 			case 'p':
 				cpu.startingPC = strtoull(optarg, NULL, 0);
 				break;
+			case 'T':
+				traceFile = optarg;
+				break;
+			case 'C':
+				coverageFile = optarg;
+				break;
+			case 'P':
+				profileInterval = strtol(optarg, NULL, 0);
+				wantDebugInfo = 1;
+				break;
+			case 'k':
+				timing = 1;
+				timingFile = optarg;
+				break;
+			case 'H':
+				clockHz = strtod(optarg, NULL);
+				break;
+			case 'I':
+				cacheConfig[CACHE_INST] = optarg;
+				break;
+			case 'D':
+				cacheConfig[CACHE_DATA] = optarg;
+				break;
+			case 'B':
+				bpredConfig = optarg;
+				wantDebugInfo = 1;
+				break;
+			case 'L':
+				pipelining = 1;
+				pipelineConfig = optarg;
+				break;
+			case 'F':
+				fastForward = 1;
+				break;
+			case 'N':
+				hooking = 1;
+				hooksMode = optarg;
+				break;
+			case 'S':
+				diskConfig = optarg;
+				break;
+			case 'U':
+				consoling = 1;
+				consoleConfig = optarg;
+				break;
+			case 'Q':
+				if (numSpiConfigs == SPI_SLAVES) {
+					fprintf(stderr, "Too many SPI slaves, there are %d select lines.\n", SPI_SLAVES);
+					exit(1);
+				}
+				spiConfig[numSpiConfigs++] = optarg;
+				break;
+			case 'R':
+				reversing = 1;
+				reverseConfig = optarg;
+				break;
+			case 'G':
+				gdbing = 1;
+				gdbConfig = optarg;
+				break;
 			case 'h':
 				usage(argc, argv);
 				break;
@@ -629,25 +1354,79 @@ int main(int argc, char **argv)
 	int			stop;
 	struct instruction o;
 	uint32_t address;
+	int			mispredicted;
+	uint32_t	lastPC;
+	uint64_t	skipped;
 
 	parseArgs(argc, argv);
 
-	initEnvironment();
+	if (initEnvironment() != 0) {
+		return(1);
+	}
 
 	cpu.pc = cpu.startingPC;
 	stop = 0;
 
 	dumpRegisters(&cpu, "", 1);
 
-	while (!stop && (cpu.maxCycles-- > 0)) {
+	while ((!stop && (cpu.maxCycles-- > 0)) || finished(&stop)) {
+
+		if (hooking != 0) {
+			hooksCheck(&cpu);
+		}
+
+		if (cpu.intPending != 0) {
+			dispatchInterrupt();
+		}
+
+		if (hooking != 0) {
+			if ((skipped = hooksCall(&cpu, quietInstructions())) != 0) {
+				advanceCounters(skipped);
+			}
+		}
+
+		if ((reversing != 0) && (cpu.ic >= reverseNext)) {
+			reverseCheckpoint();
+		}
 
 		interactive();
+		if ((gdbing != 0) && !gdbSkip(cpu.pc) && (gdbStop(&cpu) < 0)) {
+			break;
+		}
 		fetchInst(cpu.pc, &o);
 
+		if (coverageMap != NULL) {
+			coverageMark(coverageMap, cpu.pc);
+		}
+
+		if (caching != 0) {
+			cacheSetPC(cpu.pc);
+			cacheAccess(CACHE_INST, cpu.pc, 8, 0);
+		}
+
+		if (traceFile != NULL) {
+			traceInstruction(&cpu, &o);
+		}
+
 		cpu.nextPC = cpu.pc + 8;
 
 		cpu.r[R_C1]++;
 		cpu.r[R_C2]++;
+		if ((cpu.timerControl1 | cpu.timerControl2) != 0) {
+			updateTimers();
+		}
+		if (dmaBusy()) {
+			dmaTick();
+		}
+		if (blockBusy()) {
+			blockTick();
+		}
+		if (consoleBusy()) {
+			consoleTick();
+		}
+		if (spiBusy()) {
+			spiTick();
+		}
 
 		switch (o.op) {
 
@@ -757,33 +1536,33 @@ int main(int argc, char **argv)
 			break;
 		case jmp:
 			address = getAddress(o.mode, o.opr2);
-			log("jmp %" PRIX32, address);
+			log("jmp %s", symbolize(address));
 			cpu.nextPC = address;
 			break;
 		case jz:
 			address = getAddress(o.mode, o.opr2);
-			log("jz %" PRIX32, address);
+			log("jz %s", symbolize(address));
 			if (cpu.flags->z != 0) {
 				cpu.nextPC = address;
 			}
 			break;
 		case jnz:
 			address = getAddress(o.mode, o.opr2);
-			log("jnz %" PRIX32, address);
+			log("jnz %s", symbolize(address));
 			if (cpu.flags->z == 0) {
 				cpu.nextPC = address;
 			}
 			break;
 		case jl:
 			address = getAddress(o.mode, o.opr2);
-			log("jl %" PRIX32, address);
+			log("jl %s", symbolize(address));
 			if (cpu.flags->c != 0) {
 				cpu.nextPC = address;
 			}
 			break;
 		case jge:
 			address = getAddress(o.mode, o.opr2);
-			log("jg %" PRIX32, address);
+			log("jg %s", symbolize(address));
 			if ((cpu.flags->c == 0) || (cpu.flags->z != 0)) {
 				cpu.nextPC = address;
 			}
@@ -794,6 +1573,9 @@ int main(int argc, char **argv)
 		 */
 		case die:
 			log("die");
+			if (traceFile != NULL) {
+				traceDie(cpu.ic);
+			}
 			stop = 1;
 			break;
 		default:
@@ -802,16 +1584,36 @@ int main(int argc, char **argv)
 			break;
 		}
 
+		mispredicted = -1;
+		if ((bpredConfig != NULL) && (o.op >= jmp) && (o.op <= jge)) {
+			mispredicted = bpredBranch(cpu.pc, o.op, (o.mode & MODE_OPERAND) == OPR_REG,
+									   (o.op == jmp) || (cpu.nextPC != cpu.pc + 8), address);
+		}
+
+		if (pipelining != 0) {
+			pipelineInstruction(cpu.pc, &o, cpu.nextPC != cpu.pc + 8, mispredicted);
+		}
+
+		if (timing != 0) {
+			timingInstruction(o.op, (o.op >= ldw && o.op <= stb) &&
+							  (address >= cpu.mmapIOstart) && (address < cpu.mmapIOend));
+		}
+
 		dumpRegisters(&cpu, cpu.msg, 0);
 
+		cpu.ic++;
+		lastPC = cpu.pc;
 		cpu.pc = cpu.nextPC;
 		if (cpu.pc > cpu.memSize) {
 			fprintf(stderr, "ERROR: Can't access memory at 0x%" PRIX32 "\n", cpu.pc);
 			stop = 1;
 			break;
 		}
+
+		if ((fastForward != 0) && (o.op >= jmp) && (o.op <= jge) && (cpu.pc <= lastPC)) {
+			skipIdleLoop(lastPC);
+		}
 	}
-	interactive();
 
 	freeEnvironment();
 
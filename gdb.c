@@ -0,0 +1,837 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "gdb.h"
+#include "debugger.h"
+
+#define PACKET_SIZE     4096
+#define MAX_BREAKPOINTS 64
+#define MAX_WATCHPOINTS 16
+
+/*
+ * PC breakpoints set a bit in a small filter indexed by instruction, so
+ * the common case of no breakpoint at the PC is one load.
+ */
+#define FILTER_BITS 16
+#define FILTER_INDEX(pc) (((pc) >> 3) & ((1 << FILTER_BITS) - 1))
+
+/*
+ * Watchpoint types, as numbered by the Z packets.
+ */
+#define WATCH_WRITE  2
+#define WATCH_READ   3
+#define WATCH_ACCESS 4
+
+/*
+ * Signals reported in stop replies.
+ */
+#define GDB_SIGINT  2
+#define GDB_SIGTRAP 5
+
+/*
+ * gdb register numbers: r0-r15 then pc, all 32 bit. r11 is the stack
+ * pointer.
+ */
+#define GDB_PC       NUM_REGISTERS
+#define GDB_REGISTERS (NUM_REGISTERS + 1)
+
+static const char targetXML[] =
+	"<?xml version=\"1.0\"?>\n"
+	"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+	"<target version=\"1.0\">\n"
+	"  <feature name=\"org.emulator.cpu\">\n"
+	"    <reg name=\"r0\" bitsize=\"32\" regnum=\"0\" type=\"uint32\"/>\n"
+	"    <reg name=\"r1\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r2\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r3\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r4\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r5\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r6\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r7\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r8\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r9\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r10\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r11\" bitsize=\"32\" type=\"data_ptr\"/>\n"
+	"    <reg name=\"r12\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r13\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r14\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"r15\" bitsize=\"32\" type=\"uint32\"/>\n"
+	"    <reg name=\"pc\" bitsize=\"32\" type=\"code_ptr\"/>\n"
+	"  </feature>\n"
+	"</target>\n";
+
+struct watchpoint {
+	int type;
+	uint32_t address;
+	uint32_t length;
+};
+
+static struct cpuState *gdbCPU;
+
+static int listenFd = -1;
+static int clientFd = -1;
+static char *socketPath;
+static int noAck;
+
+/*
+ * Received bytes not yet parsed.
+ */
+static uint8_t input[PACKET_SIZE];
+static int inputHead;
+static int inputTail;
+
+static int stepping;
+static uint32_t pollCountdown;
+
+/*
+ * The reply to '?'. Stops are only sent unasked after gdb resumed.
+ */
+static char lastStop[64];
+static int resumed;
+static int interrupt;
+
+static uint32_t breakpoints[MAX_BREAKPOINTS];
+static int breakpointCount;
+static uint8_t breakFilter[(1 << FILTER_BITS) / 8];
+
+static struct watchpoint watchpoints[MAX_WATCHPOINTS];
+static int watchpointCount;
+static struct watchpoint *watchHit;
+static uint32_t watchHitAddress;
+
+static int listenUnix(char *path)
+{
+	struct sockaddr_un address;
+	int fd;
+
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "gdb socket path is too long: %s\n", path);
+		return -1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+		fprintf(stderr, "Can't create gdb socket: %s\n", strerror(errno));
+		return -1;
+	}
+	unlink(path);
+	if ((bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0) ||
+		(listen(fd, 1) < 0)) {
+		fprintf(stderr, "Can't listen on '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	socketPath = strdup(path);
+
+	return fd;
+}
+
+static int listenTCP(char *hostPort)
+{
+	struct addrinfo hints, *result, *ai;
+	char *host = strdup(hostPort);
+	char *port;
+	int fd = -1;
+	int one = 1;
+	int err;
+
+	if ((port = strrchr(host, ':')) == NULL) {
+		fprintf(stderr, "gdb format: tcp:<host>:<port>\n");
+		free(host);
+		return -1;
+	}
+	*port++ = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if ((err = getaddrinfo(*host != '\0' ? host : NULL, port, &hints, &result)) != 0) {
+		fprintf(stderr, "Can't resolve '%s': %s\n", hostPort, gai_strerror(err));
+		free(host);
+		return -1;
+	}
+
+	for (ai = result; ai != NULL; ai = ai->ai_next) {
+		if ((fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol)) < 0) {
+			continue;
+		}
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if ((bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) && (listen(fd, 1) == 0)) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0) {
+		fprintf(stderr, "Can't listen on '%s': %s\n", hostPort, strerror(errno));
+	}
+
+	freeaddrinfo(result);
+	free(host);
+	return fd;
+}
+
+int gdbOpen(struct cpuState *cpu, char *config)
+{
+	int one = 1;
+
+	gdbCPU = cpu;
+
+	if (strncmp(config, "unix:", 5) == 0) {
+		listenFd = listenUnix(config + 5);
+	} else if (strncmp(config, "tcp:", 4) == 0) {
+		listenFd = listenTCP(config + 4);
+	} else {
+		fprintf(stderr, "gdb format: unix:<path> or tcp:<host>:<port>\n");
+		return -1;
+	}
+	if (listenFd < 0) {
+		return -1;
+	}
+
+	fprintf(stderr, "Waiting for gdb on %s\n", config);
+	if ((clientFd = accept(listenFd, NULL, NULL)) < 0) {
+		fprintf(stderr, "Can't accept gdb: %s\n", strerror(errno));
+		return -1;
+	}
+	if (strncmp(config, "tcp:", 4) == 0) {
+		setsockopt(clientFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+
+	/*
+	 * Stop before the first instruction.
+	 */
+	stepping = 1;
+	resumed = 0;
+	pollCountdown = GDB_POLL;
+
+	return 0;
+}
+
+static void disconnect()
+{
+	if (clientFd >= 0) {
+		close(clientFd);
+		clientFd = -1;
+	}
+	inputHead = inputTail = 0;
+	breakpointCount = 0;
+	memset(breakFilter, 0, sizeof(breakFilter));
+	watchpointCount = 0;
+	watchHit = NULL;
+	free(watchPages);
+	watchPages = NULL;
+}
+
+/*
+ * Returns the next received byte or -1 if gdb went away.
+ */
+static int readByte()
+{
+	ssize_t n;
+
+	if (inputHead == inputTail) {
+		do {
+			n = recv(clientFd, input, sizeof(input), 0);
+		} while ((n < 0) && (errno == EINTR));
+		if (n <= 0) {
+			return -1;
+		}
+		inputHead = 0;
+		inputTail = n;
+	}
+
+	return input[inputHead++];
+}
+
+static int writeAll(const char *data, size_t length)
+{
+	ssize_t n;
+
+	while (length > 0) {
+		if ((n = send(clientFd, data, length, MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		data += n;
+		length -= n;
+	}
+
+	return 0;
+}
+
+static int hexValue(int c)
+{
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+/*
+ * Read one "$<data>#<checksum>" packet into 'packet', acknowledging it.
+ * Bytes between packets, like a stray Ctrl-C, are dropped.
+ *
+ * On success, returns the data length.
+ * If gdb went away, returns -1.
+ */
+static int readPacket(char *packet)
+{
+	int c, length, sum, hi, lo;
+
+	while (1) {
+		while ((c = readByte()) != '$') {
+			if (c < 0) {
+				return -1;
+			}
+		}
+
+		length = 0;
+		sum = 0;
+		while ((c = readByte()) != '#') {
+			if (c < 0) {
+				return -1;
+			}
+			if (length < PACKET_SIZE - 1) {
+				packet[length++] = c;
+			}
+			sum += c;
+		}
+		packet[length] = '\0';
+
+		if (((hi = readByte()) < 0) || ((lo = readByte()) < 0)) {
+			return -1;
+		}
+		if (noAck) {
+			return length;
+		}
+		if ((hexValue(hi) << 4 | hexValue(lo)) == (sum & 0xFF)) {
+			return writeAll("+", 1) < 0 ? -1 : length;
+		}
+		if (writeAll("-", 1) < 0) {
+			return -1;
+		}
+	}
+}
+
+/*
+ * Send 'data' as a packet and wait for gdb to acknowledge it.
+ *
+ * On success, returns 0.
+ * If gdb went away, returns -1.
+ */
+static int sendPacket(const char *data)
+{
+	static char packet[2 * PACKET_SIZE + 4];
+	int length = strlen(data);
+	int sum = 0;
+	int i, c;
+
+	packet[0] = '$';
+	for (i = 0; i < length; i++) {
+		packet[i + 1] = data[i];
+		sum += (uint8_t)data[i];
+	}
+	sprintf(packet + length + 1, "#%02x", sum & 0xFF);
+
+	do {
+		if (writeAll(packet, length + 4) < 0) {
+			return -1;
+		}
+		if (noAck) {
+			return 0;
+		}
+		while (((c = readByte()) != '+') && (c != '-')) {
+			if (c < 0) {
+				return -1;
+			}
+		}
+	} while (c == '-');
+
+	return 0;
+}
+
+/*
+ * Register values go over the wire in target (little endian) byte order.
+ */
+static char *putRegister(char *p, uint32_t value)
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		p += sprintf(p, "%02x", (value >> (8 * i)) & 0xFF);
+	}
+	return p;
+}
+
+static int getRegister(const char *p, uint32_t *value)
+{
+	int i, hi, lo;
+
+	*value = 0;
+	for (i = 0; i < 4; i++) {
+		if (((hi = hexValue(p[2 * i])) < 0) || ((lo = hexValue(p[2 * i + 1])) < 0)) {
+			return -1;
+		}
+		*value |= (uint32_t)(hi << 4 | lo) << (8 * i);
+	}
+	return 0;
+}
+
+static uint32_t *registerAt(int n)
+{
+	if (n == GDB_PC) {
+		return &gdbCPU->pc;
+	}
+	if (n >= 0 && n < NUM_REGISTERS) {
+		return &gdbCPU->r[n];
+	}
+	return NULL;
+}
+
+/*
+ * Parse "<address>,<length>" and check that it is within guest memory.
+ */
+static int parseRange(const char *p, uint32_t *address, uint32_t *length, char **end)
+{
+	uint64_t a, l;
+
+	a = strtoull(p, end, 16);
+	if (**end != ',') {
+		return -1;
+	}
+	l = strtoull(*end + 1, end, 16);
+	if (a + l > gdbCPU->memSize) {
+		return -1;
+	}
+	*address = a;
+	*length = l;
+	return 0;
+}
+
+static void readMemory(const char *args, char *reply)
+{
+	uint32_t address, length, i;
+	char *end;
+
+	if (parseRange(args, &address, &length, &end) < 0) {
+		strcpy(reply, "E01");
+		return;
+	}
+	if (length > (PACKET_SIZE - 1) / 2) {
+		length = (PACKET_SIZE - 1) / 2;
+	}
+	for (i = 0; i < length; i++) {
+		sprintf(reply + 2 * i, "%02x", gdbCPU->mem[address + i]);
+	}
+	reply[2 * length] = '\0';
+}
+
+static void writeMemory(const char *args, char *reply)
+{
+	uint32_t address, length, i;
+	char *end;
+	int hi, lo;
+
+	if ((parseRange(args, &address, &length, &end) < 0) || (*end != ':')) {
+		strcpy(reply, "E01");
+		return;
+	}
+	end++;
+	for (i = 0; i < length; i++) {
+		if (((hi = hexValue(end[2 * i])) < 0) || ((lo = hexValue(end[2 * i + 1])) < 0)) {
+			strcpy(reply, "E01");
+			return;
+		}
+		gdbCPU->mem[address + i] = hi << 4 | lo;
+	}
+	strcpy(reply, "OK");
+}
+
+static void markWatchpages()
+{
+	uint32_t page, last;
+	int i;
+
+	if (watchpointCount == 0) {
+		free(watchPages);
+		watchPages = NULL;
+		return;
+	}
+	if ((watchPages == NULL) &&
+		((watchPages = calloc(1, WATCH_PAGES / 8)) == NULL)) {
+		fprintf(stderr, "Can't allocate watchpoint map: %s\n", strerror(errno));
+		exit(1);
+	}
+	memset(watchPages, 0, WATCH_PAGES / 8);
+	for (i = 0; i < watchpointCount; i++) {
+		last = (watchpoints[i].address + watchpoints[i].length - 1) >> WATCH_PAGE_SHIFT;
+		for (page = watchpoints[i].address >> WATCH_PAGE_SHIFT; page <= last; page++) {
+			watchPages[page / 8] |= 1 << (page % 8);
+		}
+	}
+}
+
+static void markBreakpoints()
+{
+	int i;
+
+	memset(breakFilter, 0, sizeof(breakFilter));
+	for (i = 0; i < breakpointCount; i++) {
+		breakFilter[FILTER_INDEX(breakpoints[i]) / 8] |= 1 << (FILTER_INDEX(breakpoints[i]) % 8);
+	}
+}
+
+/*
+ * Z<type>,<address>,<kind> inserts and z<type>,<address>,<kind> removes.
+ */
+static void setPoint(const char *args, int insert, char *reply)
+{
+	uint64_t address, length;
+	char *end;
+	int type, i;
+
+	type = strtol(args, &end, 16);
+	if (*end != ',') {
+		strcpy(reply, "E01");
+		return;
+	}
+	address = strtoull(end + 1, &end, 16);
+	if (*end != ',') {
+		strcpy(reply, "E01");
+		return;
+	}
+	length = strtoull(end + 1, &end, 16);
+
+	if (type == 0 || type == 1) {
+		for (i = 0; i < breakpointCount && breakpoints[i] != address; i++) {
+		}
+		if (insert && i == breakpointCount) {
+			if (breakpointCount == MAX_BREAKPOINTS) {
+				strcpy(reply, "E02");
+				return;
+			}
+			breakpoints[breakpointCount++] = address;
+		} else if (!insert && i < breakpointCount) {
+			breakpoints[i] = breakpoints[--breakpointCount];
+		}
+		markBreakpoints();
+		strcpy(reply, "OK");
+		return;
+	}
+
+	if (type < WATCH_WRITE || type > WATCH_ACCESS) {
+		reply[0] = '\0';
+		return;
+	}
+	if ((length == 0) || (address + length > (uint64_t)UINT32_MAX + 1)) {
+		strcpy(reply, "E01");
+		return;
+	}
+	for (i = 0; i < watchpointCount; i++) {
+		if ((watchpoints[i].type == type) && (watchpoints[i].address == address) &&
+			(watchpoints[i].length == length)) {
+			break;
+		}
+	}
+	if (insert && i == watchpointCount) {
+		if (watchpointCount == MAX_WATCHPOINTS) {
+			strcpy(reply, "E02");
+			return;
+		}
+		watchpoints[watchpointCount].type = type;
+		watchpoints[watchpointCount].address = address;
+		watchpoints[watchpointCount].length = length;
+		watchpointCount++;
+	} else if (!insert && i < watchpointCount) {
+		watchpoints[i] = watchpoints[--watchpointCount];
+	}
+	watchHit = NULL;
+	markWatchpages();
+	strcpy(reply, "OK");
+}
+
+static void readFeatures(const char *args, char *reply)
+{
+	uint32_t offset, length, size = sizeof(targetXML) - 1;
+	char *end;
+
+	if (strncmp(args, "target.xml:", 11) != 0) {
+		strcpy(reply, "E00");
+		return;
+	}
+	offset = strtoul(args + 11, &end, 16);
+	if (*end != ',') {
+		strcpy(reply, "E00");
+		return;
+	}
+	length = strtoul(end + 1, NULL, 16);
+	if (length > PACKET_SIZE - 2) {
+		length = PACKET_SIZE - 2;
+	}
+
+	if (offset >= size) {
+		strcpy(reply, "l");
+		return;
+	}
+	if (length >= size - offset) {
+		length = size - offset;
+		reply[0] = 'l';
+	} else {
+		reply[0] = 'm';
+	}
+	memcpy(reply + 1, targetXML + offset, length);
+	reply[length + 1] = '\0';
+}
+
+/*
+ * Stop reply: SIGINT for Ctrl-C, otherwise SIGTRAP with the address for
+ * watchpoints.
+ */
+static void stopReason(char *reply)
+{
+	static const char *watchNames[] = {"watch", "rwatch", "awatch"};
+
+	if (interrupt) {
+		sprintf(reply, "S%02x", GDB_SIGINT);
+	} else if (watchHit != NULL) {
+		sprintf(reply, "T%02x%s:%" PRIx32 ";", GDB_SIGTRAP,
+		        watchNames[watchHit->type - WATCH_WRITE], watchHitAddress);
+	} else {
+		sprintf(reply, "S%02x", GDB_SIGTRAP);
+	}
+}
+
+/*
+ * Polls for a Ctrl-C from gdb while running.
+ */
+static int interrupted()
+{
+	struct pollfd fds = {clientFd, POLLIN, 0};
+	int c;
+
+	while (inputHead != inputTail || poll(&fds, 1, 0) > 0) {
+		if ((c = readByte()) < 0) {
+			return 1;
+		}
+		if (c == 0x03) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int gdbSkip(uint32_t pc)
+{
+	if (clientFd < 0) {
+		return 1;
+	}
+	if (stepping || watchHit != NULL) {
+		return 0;
+	}
+	if ((breakFilter[FILTER_INDEX(pc) / 8] >> (FILTER_INDEX(pc) % 8)) & 1) {
+		int i;
+
+		for (i = 0; i < breakpointCount; i++) {
+			if (breakpoints[i] == pc) {
+				return 0;
+			}
+		}
+	}
+	if (--pollCountdown == 0) {
+		pollCountdown = GDB_POLL;
+		if (interrupted()) {
+			interrupt = 1;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int gdbStop(struct cpuState *cpu)
+{
+	static char packet[PACKET_SIZE];
+	static char reply[2 * PACKET_SIZE];
+	uint32_t value, *reg;
+	char *p;
+	int i, n;
+
+	if (clientFd < 0) {
+		return 0;
+	}
+
+	stepping = 0;
+	stopReason(lastStop);
+	watchHit = NULL;
+	interrupt = 0;
+	if (resumed && (sendPacket(lastStop) < 0)) {
+		goto GONE;
+	}
+
+	while (readPacket(packet) >= 0) {
+		reply[0] = '\0';
+
+		switch (packet[0]) {
+			case '?':
+				strcpy(reply, lastStop);
+				break;
+			case 'g':
+				for (p = reply, i = 0; i < GDB_REGISTERS; i++) {
+					p = putRegister(p, *registerAt(i));
+				}
+				break;
+			case 'G':
+				for (i = 0; i < GDB_REGISTERS; i++) {
+					if (getRegister(packet + 1 + 8 * i, &value) < 0) {
+						break;
+					}
+					*registerAt(i) = value;
+				}
+				strcpy(reply, i == GDB_REGISTERS ? "OK" : "E01");
+				break;
+			case 'p':
+				if ((reg = registerAt(strtol(packet + 1, NULL, 16))) == NULL) {
+					strcpy(reply, "E01");
+					break;
+				}
+				putRegister(reply, *reg);
+				break;
+			case 'P':
+				n = strtol(packet + 1, &p, 16);
+				if ((*p != '=') || ((reg = registerAt(n)) == NULL) ||
+					(getRegister(p + 1, &value) < 0)) {
+					strcpy(reply, "E01");
+					break;
+				}
+				*reg = value;
+				strcpy(reply, "OK");
+				break;
+			case 'm':
+				readMemory(packet + 1, reply);
+				break;
+			case 'M':
+				writeMemory(packet + 1, reply);
+				break;
+			case 'Z':
+			case 'z':
+				setPoint(packet + 1, packet[0] == 'Z', reply);
+				break;
+			case 's':
+			case 'c':
+				if (packet[1] != '\0') {
+					cpu->pc = strtoul(packet + 1, NULL, 16);
+				}
+				stepping = packet[0] == 's';
+				resumed = 1;
+				pollCountdown = GDB_POLL;
+				return 0;
+			case 'D':
+				sendPacket("OK");
+				fprintf(stderr, "gdb detached\n");
+				disconnect();
+				return 0;
+			case 'k':
+				fprintf(stderr, "gdb killed the program\n");
+				disconnect();
+				return -1;
+			case 'H':
+			case 'T':
+				strcpy(reply, "OK");
+				break;
+			case 'q':
+				if (strncmp(packet, "qSupported", 10) == 0) {
+					sprintf(reply, "PacketSize=%x;qXfer:features:read+;QStartNoAckMode+", PACKET_SIZE);
+				} else if (strncmp(packet, "qXfer:features:read:", 20) == 0) {
+					readFeatures(packet + 20, reply);
+				} else if (strcmp(packet, "qAttached") == 0) {
+					strcpy(reply, "1");
+				} else if (strcmp(packet, "qC") == 0) {
+					strcpy(reply, "QC1");
+				} else if (strcmp(packet, "qfThreadInfo") == 0) {
+					strcpy(reply, "m1");
+				} else if (strcmp(packet, "qsThreadInfo") == 0) {
+					strcpy(reply, "l");
+				}
+				break;
+			case 'Q':
+				if (strcmp(packet, "QStartNoAckMode") == 0) {
+					if (sendPacket("OK") < 0) {
+						goto GONE;
+					}
+					noAck = 1;
+					continue;
+				}
+				break;
+		}
+
+		if (sendPacket(reply) < 0) {
+			break;
+		}
+	}
+
+GONE:
+	fprintf(stderr, "gdb went away\n");
+	disconnect();
+	return -1;
+}
+
+void gdbWatch(uint32_t address, uint32_t size, int write)
+{
+	struct watchpoint *w;
+	int i;
+
+	if (watchHit != NULL) {
+		return;
+	}
+
+	for (i = 0; i < watchpointCount; i++) {
+		w = &watchpoints[i];
+		if ((w->type == WATCH_ACCESS) ||
+			(w->type == WATCH_READ && !write) ||
+			(w->type == WATCH_WRITE && write)) {
+			if (address < w->address + (uint64_t)w->length && w->address < address + (uint64_t)size) {
+				watchHit = w;
+				watchHitAddress = address;
+				return;
+			}
+		}
+	}
+}
+
+void gdbClose()
+{
+	if (clientFd >= 0) {
+		sendPacket("W00");
+		disconnect();
+	}
+	if (listenFd >= 0) {
+		close(listenFd);
+		listenFd = -1;
+	}
+	if (socketPath != NULL) {
+		unlink(socketPath);
+		free(socketPath);
+		socketPath = NULL;
+	}
+}
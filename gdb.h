@@ -0,0 +1,58 @@
+#ifndef __GDB_H
+#define __GDB_H
+
+#include <inttypes.h>
+
+#include "cpu.h"
+
+/*
+ * GDB remote serial protocol stub.
+ *
+ * The emulator waits for gdb to connect, then stops before the first
+ * instruction. gdb sees r0-r15 and pc (see the target description in
+ * gdb.c), reads and writes guest memory directly, and can set software
+ * breakpoints (Z0/Z1) and write, read and access watchpoints (Z2-Z4).
+ * Breakpoints are kept by the stub, guest memory is never patched.
+ *
+ * Between stops the emulator runs its normal loop: gdbSkip() is a flag
+ * and bitmap test, and the socket is only polled for an interrupt
+ * (Ctrl-C) every GDB_POLL instructions.
+ */
+#define GDB_POLL 65536
+
+/*
+ * Listen on 'config', unix:<path> or tcp:<host>:<port>, and wait for gdb
+ * to connect.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int gdbOpen(struct cpuState *cpu, char *config);
+
+/*
+ * Tell gdb the program exited if it is still connected, and close the
+ * sockets.
+ */
+void gdbClose();
+
+/*
+ * Returns 1 if the instruction at 'pc' can run without stopping for gdb.
+ */
+int gdbSkip(uint32_t pc);
+
+/*
+ * Report the stop to gdb and serve its requests until it continues or
+ * steps.
+ *
+ * Returns 0 when execution goes on.
+ * Returns -1 if gdb killed the program or went away.
+ */
+int gdbStop(struct cpuState *cpu);
+
+/*
+ * Called for accesses to pages marked in watchPages (see debugger.h)
+ * while gdb has watchpoints. A hit stops before the next instruction.
+ */
+void gdbWatch(uint32_t address, uint32_t size, int write);
+
+#endif /* __GDB_H */
@@ -0,0 +1,390 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "hooks.h"
+#include "symbols.h"
+#include "isa.h"
+
+/*
+ * A host implementation works on a copy of the registers and on 'mem',
+ * which is either guest memory or, in verify mode, a shadow copy of it.
+ * It must check everything before it modifies anything: once it starts
+ * writing it can no longer decline.
+ *
+ * Returns the number of guest instructions the call takes, or 0 to let
+ * the guest code run.
+ */
+typedef uint64_t (*hookFn)(struct cpuState *cpu, uint32_t *r, uint8_t *mem,
+                           uint32_t *pc, uint64_t maxInstructions);
+
+typedef struct Hook
+{
+	char *name;
+	hookFn fn;
+
+	int resolved;
+	uint32_t pc;
+
+	uint64_t calls;
+	uint64_t declined;
+	uint64_t instructions;
+	uint64_t mismatches;
+} Hook;
+
+static uint64_t hookMemcpy(struct cpuState *cpu, uint32_t *r, uint8_t *mem, uint32_t *pc, uint64_t max);
+static uint64_t hookMemset(struct cpuState *cpu, uint32_t *r, uint8_t *mem, uint32_t *pc, uint64_t max);
+static uint64_t hookStrlen(struct cpuState *cpu, uint32_t *r, uint8_t *mem, uint32_t *pc, uint64_t max);
+static uint64_t hookStrcpy(struct cpuState *cpu, uint32_t *r, uint8_t *mem, uint32_t *pc, uint64_t max);
+
+static Hook hooks[] = {
+	{"memcpy", hookMemcpy},
+	{"memset", hookMemset},
+	{"strlen", hookStrlen},
+	{"strcpy", hookStrcpy},
+};
+
+#define NUM_HOOKS (sizeof(hooks) / sizeof(*hooks))
+
+/*
+ * Entry points span a small range, so most PCs are rejected with two
+ * compares.
+ */
+static uint32_t lowestPC = UINT32_MAX;
+static uint32_t highestPC;
+
+/*
+ * Verify mode: the expected machine state after the guest routine.
+ */
+static int verifying;
+static uint8_t *shadow;
+static Hook *pending;
+static uint64_t expectIC;
+static uint32_t expectPC;
+static uint32_t expectR[NUM_REGISTERS];
+
+int hooksInit(struct cpuState *cpu, int verify)
+{
+	int i;
+
+	for (i = 0; i < NUM_HOOKS; i++) {
+		if (symbolsLookupName(hooks[i].name, &hooks[i].pc) < 0) {
+			continue;
+		}
+		hooks[i].resolved = 1;
+		if (hooks[i].pc < lowestPC) {
+			lowestPC = hooks[i].pc;
+		}
+		if (hooks[i].pc > highestPC) {
+			highestPC = hooks[i].pc;
+		}
+	}
+
+	verifying = verify;
+	if (verifying && (shadow = malloc(cpu->memSize)) == NULL) {
+		fprintf(stderr, "Can't allocate shadow memory: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static uint32_t load32(uint8_t *mem, uint32_t address)
+{
+	return mem[address] | (mem[address + 1] << 8) | (mem[address + 2] << 16) |
+	       ((uint32_t)mem[address + 3] << 24);
+}
+
+static void store32(uint8_t *mem, uint32_t address, uint32_t value)
+{
+	mem[address] = value;
+	mem[address + 1] = value >> 8;
+	mem[address + 2] = value >> 16;
+	mem[address + 3] = value >> 24;
+}
+
+static int overlaps(uint32_t a, uint64_t aSize, uint32_t b, uint64_t bSize)
+{
+	return ((uint64_t)a < b + bSize) && ((uint64_t)b < a + aSize);
+}
+
+/*
+ * Length of the NUL terminated string at 'address' including the NUL,
+ * or 0 if it runs off the end of memory.
+ */
+static uint64_t stringSize(struct cpuState *cpu, uint8_t *mem, uint32_t address)
+{
+	uint64_t i;
+
+	for (i = address; i < cpu->memSize; i++) {
+		if (mem[i] == 0) {
+			return i - address + 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Every routine ends with "ldw r4 sp; add sp sp <pop>; jmp r4". Check
+ * that it will work and that 'written' bytes at 'address' don't clobber
+ * the return address first.
+ */
+static int checkReturn(struct cpuState *cpu, uint32_t *r, uint8_t *mem,
+                       uint32_t address, uint64_t written)
+{
+	uint32_t slot = r[R_BA] + r[R_SP];
+
+	if (!isMemory(cpu, slot, 4) || overlaps(address, written, slot, 4)) {
+		return -1;
+	}
+	if (r[R_BA] + load32(mem, slot) >= cpu->memSize) {
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * The last "cmp <reg> 0" of the loop matched and the epilogue pops
+ * 'pop' bytes, possibly setting the carry.
+ */
+static void doReturn(uint32_t *r, uint8_t *mem, uint32_t pop, uint32_t *pc)
+{
+	r[R_FL] = (r[R_FL] & ~(FL_Z | FL_C)) | FL_Z;
+
+	r[4] = load32(mem, r[R_BA] + r[R_SP]);
+	if ((UINT32_MAX - r[R_SP]) < pop) {
+		r[R_FL] |= FL_C;
+	}
+	r[R_SP] += pop;
+	*pc = r[R_BA] + r[4];
+}
+
+/*
+ * memcpy copies a word every 2 bytes and pops only 2 bytes on return;
+ * both are reproduced as is.
+ */
+static uint64_t hookMemcpy(struct cpuState *cpu, uint32_t *r, uint8_t *mem, uint32_t *pc, uint64_t max)
+{
+	uint32_t dst = r[R_BA] + r[0];
+	uint32_t src = r[R_BA] + r[1];
+	uint32_t words = r[2] / 2;
+	uint64_t n = 7 * (uint64_t)words + 3;
+	uint32_t i;
+
+	if (r[2] == 0 || (r[2] & 1) || n > max) {
+		return 0;
+	}
+	if (!isMemory(cpu, src, r[2] + 2) || !isMemory(cpu, dst, r[2] + 2) ||
+		checkReturn(cpu, r, mem, dst, r[2] + 2) < 0) {
+		return 0;
+	}
+
+	for (i = 0; i < words; i++) {
+		r[3] = load32(mem, src + 2 * i);
+		store32(mem, dst + 2 * i, r[3]);
+	}
+	r[0] += 2 * words;
+	r[1] += 2 * words;
+	r[2] = 0;
+
+	doReturn(r, mem, 2, pc);
+
+	return n;
+}
+
+static uint64_t hookMemset(struct cpuState *cpu, uint32_t *r, uint8_t *mem, uint32_t *pc, uint64_t max)
+{
+	uint32_t dst = r[R_BA] + r[0];
+	uint32_t words = r[2] / 2;
+	uint64_t n = 5 * (uint64_t)words + 3;
+	uint32_t i;
+
+	if (r[2] == 0 || (r[2] & 1) || n > max) {
+		return 0;
+	}
+	if (!isMemory(cpu, dst, r[2] + 2) || checkReturn(cpu, r, mem, dst, r[2] + 2) < 0) {
+		return 0;
+	}
+
+	for (i = 0; i < words; i++) {
+		store32(mem, dst + 2 * i, r[1]);
+	}
+	r[0] += 2 * words;
+	r[2] = 0;
+
+	doReturn(r, mem, 4, pc);
+
+	return n;
+}
+
+static uint64_t hookStrlen(struct cpuState *cpu, uint32_t *r, uint8_t *mem, uint32_t *pc, uint64_t max)
+{
+	uint32_t src = r[R_BA] + r[0];
+	uint64_t size = stringSize(cpu, mem, src);
+	uint64_t n = 5 * size + 5;
+
+	if (size == 0 || n > max || !isMemory(cpu, src, size) ||
+		checkReturn(cpu, r, mem, 0, 0) < 0) {
+		return 0;
+	}
+
+	r[0] += size;
+	r[2] = 0;
+	r[3] = size - 1;
+
+	doReturn(r, mem, 4, pc);
+
+	return n;
+}
+
+/*
+ * strcpy stores every byte as a word, so it writes 3 bytes past the NUL.
+ * Overlapping strings are left to the guest.
+ */
+static uint64_t hookStrcpy(struct cpuState *cpu, uint32_t *r, uint8_t *mem, uint32_t *pc, uint64_t max)
+{
+	uint32_t dst = r[R_BA] + r[0];
+	uint32_t src = r[R_BA] + r[1];
+	uint64_t size = stringSize(cpu, mem, src);
+	uint64_t n = 6 * size + 3;
+	uint32_t i;
+
+	if (size == 0 || n > max) {
+		return 0;
+	}
+	if (!isMemory(cpu, src, size) || !isMemory(cpu, dst, size + 3) ||
+		overlaps(dst, size + 3, src, size) ||
+		checkReturn(cpu, r, mem, dst, size + 3) < 0) {
+		return 0;
+	}
+
+	for (i = 0; i < size; i++) {
+		store32(mem, dst + i, mem[src + i]);
+	}
+	r[0] += size;
+	r[1] += size;
+	r[2] = 0;
+
+	doReturn(r, mem, 4, pc);
+
+	return n;
+}
+
+static Hook *findHook(uint32_t pc)
+{
+	int i;
+
+	if (pc < lowestPC || pc > highestPC) {
+		return NULL;
+	}
+	for (i = 0; i < NUM_HOOKS; i++) {
+		if (hooks[i].resolved && hooks[i].pc == pc) {
+			return &hooks[i];
+		}
+	}
+	return NULL;
+}
+
+uint64_t hooksCall(struct cpuState *cpu, uint64_t maxInstructions)
+{
+	uint32_t r[NUM_REGISTERS];
+	uint32_t pc;
+	uint64_t n;
+	Hook *hook;
+	int i;
+
+	if ((hook = findHook(cpu->pc)) == NULL || pending != NULL) {
+		return 0;
+	}
+
+	if (verifying) {
+		memcpy(shadow, cpu->mem, cpu->memSize);
+		memcpy(expectR, cpu->r, sizeof(expectR));
+		if ((n = hook->fn(cpu, expectR, shadow, &expectPC, maxInstructions)) == 0) {
+			hook->declined++;
+			return 0;
+		}
+		expectR[R_C1] += n;
+		expectR[R_C2] += n;
+		expectIC = cpu->ic + n;
+		pending = hook;
+		hook->calls++;
+		hook->instructions += n;
+		return 0;
+	}
+
+	memcpy(r, cpu->r, sizeof(r));
+	if ((n = hook->fn(cpu, r, cpu->mem, &pc, maxInstructions)) == 0) {
+		hook->declined++;
+		return 0;
+	}
+
+	for (i = 0; i < NUM_REGISTERS; i++) {
+		if (i != R_C1 && i != R_C2) {
+			cpu->r[i] = r[i];
+		}
+	}
+	cpu->pc = pc;
+
+	hook->calls++;
+	hook->instructions += n;
+
+	return n;
+}
+
+void hooksCheck(struct cpuState *cpu)
+{
+	uint32_t i;
+
+	if (pending == NULL || cpu->ic < expectIC) {
+		return;
+	}
+
+	if (cpu->pc != expectPC) {
+		fprintf(stderr, "hook %s: guest returned to 0x%" PRIX32 ", host to 0x%" PRIX32 "\n",
+		        pending->name, cpu->pc, expectPC);
+		pending->mismatches++;
+	}
+	for (i = 0; i < NUM_REGISTERS; i++) {
+		if (cpu->r[i] != expectR[i]) {
+			fprintf(stderr, "hook %s: r%" PRIu32 " is 0x%" PRIX32 " in the guest, 0x%" PRIX32 " in the host\n",
+			        pending->name, i, cpu->r[i], expectR[i]);
+			pending->mismatches++;
+		}
+	}
+	if (memcmp(shadow, cpu->mem, cpu->memSize) != 0) {
+		for (i = 0; shadow[i] == cpu->mem[i]; i++) {
+		}
+		fprintf(stderr, "hook %s: memory differs at 0x%" PRIX32 ", 0x%02X in the guest, 0x%02X in the host\n",
+		        pending->name, i, cpu->mem[i], shadow[i]);
+		pending->mismatches++;
+	}
+
+	pending = NULL;
+}
+
+void hooksReport(FILE *stream)
+{
+	int i;
+
+	fprintf(stream, "\nNative hooks%s:\n", verifying ? " (verified against the guest)" : "");
+	fprintf(stream, "%-10s %-10s %10s %10s %14s %10s\n", "routine", "pc",
+	        "calls", "declined", "instructions", "mismatches");
+	for (i = 0; i < NUM_HOOKS; i++) {
+		Hook *h = &hooks[i];
+
+		if (!h->resolved) {
+			continue;
+		}
+		fprintf(stream, "%-10s 0x%-8" PRIX32 " %10" PRIu64 " %10" PRIu64 " %14" PRIu64 " %10" PRIu64 "\n",
+		        h->name, h->pc, h->calls, h->declined, h->instructions, h->mismatches);
+	}
+}
+
+void hooksFree()
+{
+	free(shadow);
+	shadow = NULL;
+}
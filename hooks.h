@@ -0,0 +1,50 @@
+#ifndef __HOOKS_H
+#define __HOOKS_H
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+/*
+ * Run host implementations of the hot progs/lib.asm routines (memcpy,
+ * memset, strlen, strcpy) instead of emulating them. Entry points are
+ * resolved from the loaded *.sym files, so symbols must be loaded first.
+ *
+ * With 'verify' set the host version runs on a copy of the machine and
+ * the guest version still runs; both results are compared when the
+ * guest returns.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int hooksInit(struct cpuState *cpu, int verify);
+
+/*
+ * If cpu->pc is the entry point of a hooked routine, run it natively and
+ * return to the caller through r4 like the guest code would. Registers
+ * except r14/r15 are left exactly as the guest would leave them.
+ *
+ * Hooks decline arguments the guest routine would not handle (and
+ * anything touching memory mapped I/O) as well as calls that would take
+ * more than 'maxInstructions' instructions.
+ *
+ * Returns the number of guest instructions the call stands for (the
+ * caller accounts for them in ic, r14/r15 and timers), or 0 if the guest
+ * code has to run.
+ */
+uint64_t hooksCall(struct cpuState *cpu, uint64_t maxInstructions);
+
+/*
+ * In verify mode, compare the guest state with the host result once the
+ * guest routine has run for the expected number of instructions.
+ */
+void hooksCheck(struct cpuState *cpu);
+
+/*
+ * Print per routine call counts and the instructions saved.
+ */
+void hooksReport(FILE *stream);
+
+void hooksFree();
+
+#endif /* __HOOKS_H */
@@ -0,0 +1,481 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "idle.h"
+#include "isa.h"
+
+/*
+ * Only loops of a few straight-line instructions are considered, and a
+ * skip has to be worth the analysis.
+ */
+#define IDLE_MAX_BODY   8
+#define IDLE_MIN_SKIP   16
+
+#define NEVER           UINT64_MAX
+
+/*
+ * A value during one loop iteration, expressed as the value 'reg' had at
+ * the top of the iteration plus 'offset'. Values that are the same in
+ * every iteration have 'reg' -1 and are known exactly.
+ */
+typedef struct Value
+{
+	int reg;
+	uint32_t offset;
+} Value;
+
+typedef struct Compare
+{
+	Value a;
+	Value b;
+} Compare;
+
+static idlePeekFn peekFn;
+
+static uint64_t loopsSkipped;
+static uint64_t instructionsSkipped;
+
+void idleInit(idlePeekFn peek)
+{
+	peekFn = peek;
+}
+
+static void decode(uint8_t *i, struct instruction *o)
+{
+	o->op = i[0];
+	o->mode = i[1];
+	o->reg0 = i[2];
+	o->reg1 = i[3];
+	o->raw2 = i[4] | (i[5] << 8) | (i[6] << 16) | ((uint32_t)i[7] << 24);
+}
+
+static int isBranch(uint8_t op)
+{
+	return (op >= jmp) && (op <= jge);
+}
+
+static int branchTaken(uint8_t op, uint32_t flags)
+{
+	switch (op) {
+		case jz:
+			return (flags & FL_Z) != 0;
+		case jnz:
+			return (flags & FL_Z) == 0;
+		case jl:
+			return (flags & FL_C) != 0;
+		case jge:
+			return ((flags & FL_C) == 0) || ((flags & FL_Z) != 0);
+		default:
+			return 1;
+	}
+}
+
+/*
+ * Run one iteration of the loop on the register file 'r' the way the
+ * emulator would: operands are fetched before the cycle counters are
+ * incremented. Every exit branch must fall through and the closing
+ * branch must be taken.
+ *
+ * On success, returns 0.
+ * If the iteration would leave the loop, returns -1.
+ */
+static int dryRun(struct instruction *body, int n, uint32_t *r)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		struct instruction *o = &body[i];
+		uint32_t opr0 = r[o->reg0];
+		uint32_t opr1 = r[o->reg1];
+		uint32_t opr2 = (o->mode & MODE_OPERAND) == OPR_REG ? r[o->raw2] : o->raw2;
+		uint32_t address = (o->mode & MODE_ADDRESS) == ADDR_REL ? r[R_BA] + opr2 : opr2;
+		uint32_t value;
+
+		r[R_C1]++;
+		r[R_C2]++;
+
+		switch (o->op) {
+			case add:
+				r[o->reg0] = opr1 + opr2;
+				if ((UINT32_MAX - opr1) < opr2) {
+					r[R_FL] |= FL_C;
+				}
+				break;
+			case sub: r[o->reg0] = opr1 - opr2; break;
+			case mul: r[o->reg0] = opr1 * opr2; break;
+			case div: r[o->reg0] = opr1 / opr2; break;
+			case and: r[o->reg0] = opr1 & opr2; break;
+			case or:  r[o->reg0] = opr1 | opr2; break;
+			case xor: r[o->reg0] = opr1 ^ opr2; break;
+			case nor: r[o->reg0] = ~opr1 & ~opr2; break;
+			case lsl: r[o->reg0] = opr1 << opr2; break;
+			case lsr: r[o->reg0] = opr1 >> opr2; break;
+			case mov: r[o->reg0] = opr2; break;
+			case ldw:
+			case ldb:
+				if (peekFn(address, o->op == ldw ? 4 : 1, &value) < 0) {
+					return -1;
+				}
+				r[o->reg0] = value;
+				break;
+			case cmp:
+				r[R_FL] &= ~(FL_Z | FL_C);
+				r[R_FL] |= (opr0 == opr2) ? FL_Z : 0;
+				r[R_FL] |= (opr0 < opr2) ? FL_C : 0;
+				break;
+			default:
+				if (isBranch(o->op) && (branchTaken(o->op, r[R_FL]) != (i == n - 1))) {
+					return -1;
+				}
+				break;
+		}
+	}
+
+	return 0;
+}
+
+static int readOperand(Value *regs, uint8_t reg, int index, Value *v)
+{
+	if (reg >= NUM_REGISTERS || reg == R_FL) {
+		return -1;
+	}
+	*v = regs[reg];
+	if (reg == R_C1 || reg == R_C2) {
+		v->reg = reg;
+		v->offset = index;
+	}
+	return 0;
+}
+
+/*
+ * Walk the loop body once with symbolic values, checking that it has no
+ * side effects and that every register it writes ends the iteration as
+ * a constant or as its own (or a counter's) value plus a constant.
+ *
+ * On success, returns the number of compares and fills 'delta' with the
+ * per-iteration change of every register.
+ * If the loop can't be skipped, returns -1.
+ */
+static int analyse(struct cpuState *cpu, struct instruction *body, int n,
+                   uint32_t head, uint32_t *delta, Compare *compares)
+{
+	Value regs[NUM_REGISTERS];
+	uint32_t written = 0;
+	int numCompares = 0;
+	int lastCompare = -1;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (body[i].reg0 >= NUM_REGISTERS || body[i].reg1 >= NUM_REGISTERS) {
+			return -1;
+		}
+		if (!isBranch(body[i].op) && body[i].op != cmp && body[i].op != nop) {
+			written |= 1 << body[i].reg0;
+		}
+	}
+	if (written & ((1 << R_FL) | (1 << R_C1) | (1 << R_C2))) {
+		return -1;
+	}
+
+	for (i = 0; i < NUM_REGISTERS; i++) {
+		regs[i].reg = (written & (1 << i)) ? i : -1;
+		regs[i].offset = (written & (1 << i)) ? 0 : cpu->r[i];
+	}
+
+	for (i = 0; i < n; i++) {
+		struct instruction *o = &body[i];
+		Value a, b, result;
+		uint32_t address;
+
+		if ((o->mode & MODE_OPERAND) == OPR_REG) {
+			if (readOperand(regs, o->raw2, i, &b) < 0) {
+				return -1;
+			}
+		} else {
+			b.reg = -1;
+			b.offset = o->raw2;
+		}
+
+		switch (o->op) {
+			case nop:
+				continue;
+			case mov:
+				result = b;
+				break;
+			case add:
+			case sub:
+				if (readOperand(regs, o->reg1, i, &a) < 0) {
+					return -1;
+				}
+				if (o->op == add && a.reg >= 0 && b.reg >= 0) {
+					return -1;
+				}
+				if (o->op == sub && b.reg >= 0 && b.reg != a.reg) {
+					return -1;
+				}
+				if (o->op == add) {
+					result.reg = a.reg >= 0 ? a.reg : b.reg;
+					result.offset = a.offset + b.offset;
+					/*
+					 * A carry would change the flags the next branch tests.
+					 */
+					lastCompare = -1;
+				} else {
+					result.reg = b.reg >= 0 ? -1 : a.reg;
+					result.offset = a.offset - b.offset;
+				}
+				break;
+			case mul:
+			case div:
+			case and:
+			case or:
+			case xor:
+			case nor:
+			case lsl:
+			case lsr:
+				if (readOperand(regs, o->reg1, i, &a) < 0 || a.reg >= 0 || b.reg >= 0) {
+					return -1;
+				}
+				if (o->op == div && b.offset == 0) {
+					return -1;
+				}
+				result.reg = -1;
+				switch (o->op) {
+					case mul: result.offset = a.offset * b.offset; break;
+					case div: result.offset = a.offset / b.offset; break;
+					case and: result.offset = a.offset & b.offset; break;
+					case or:  result.offset = a.offset | b.offset; break;
+					case xor: result.offset = a.offset ^ b.offset; break;
+					case nor: result.offset = ~a.offset & ~b.offset; break;
+					case lsl: result.offset = a.offset << b.offset; break;
+					default:  result.offset = a.offset >> b.offset; break;
+				}
+				break;
+			case ldw:
+			case ldb:
+				/*
+				 * Nothing in the loop stores, so a load from a fixed
+				 * address returns the same value every iteration.
+				 */
+				if (b.reg >= 0 ||
+					((o->mode & MODE_ADDRESS) == ADDR_REL && regs[R_BA].reg >= 0)) {
+					return -1;
+				}
+				address = b.offset + ((o->mode & MODE_ADDRESS) == ADDR_REL ? regs[R_BA].offset : 0);
+				result.reg = -1;
+				if (peekFn(address, o->op == ldw ? 4 : 1, &result.offset) < 0) {
+					return -1;
+				}
+				break;
+			case cmp:
+				if (readOperand(regs, o->reg0, i, &compares[numCompares].a) < 0) {
+					return -1;
+				}
+				compares[numCompares].b = b;
+				lastCompare = numCompares++;
+				continue;
+			case jmp:
+			case jz:
+			case jnz:
+			case jl:
+			case jge:
+				if (b.reg >= 0 || ((o->mode & MODE_ADDRESS) == ADDR_REL && regs[R_BA].reg >= 0)) {
+					return -1;
+				}
+				address = b.offset + ((o->mode & MODE_ADDRESS) == ADDR_REL ? regs[R_BA].offset : 0);
+				if (i == n - 1) {
+					if (address != head) {
+						return -1;
+					}
+				} else if (o->op == jmp ||
+						   (address >= head && address <= head + 8 * (n - 1))) {
+					return -1;
+				}
+				if (o->op != jmp && lastCompare < 0) {
+					return -1;
+				}
+				continue;
+			default:
+				return -1;
+		}
+		regs[o->reg0] = result;
+	}
+
+	/*
+	 * Registers settle into a linear progression after one iteration.
+	 */
+	for (i = 0; i < NUM_REGISTERS; i++) {
+		Value *end = &regs[i];
+
+		delta[i] = 0;
+		if (i == R_C1 || i == R_C2) {
+			delta[i] = n;
+		} else if ((written & (1 << i)) == 0 || end->reg < 0) {
+			continue;
+		} else if (end->reg == i) {
+			delta[i] = end->offset;
+		} else if (end->reg == R_C1 || end->reg == R_C2) {
+			delta[i] = n;
+		} else if (regs[end->reg].reg == end->reg) {
+			delta[i] = regs[end->reg].offset;
+		} else {
+			return -1;
+		}
+	}
+
+	return numCompares;
+}
+
+static uint64_t valueAt(uint32_t *r, Value *v)
+{
+	return v->reg < 0 ? v->offset : (uint32_t)(r[v->reg] + v->offset);
+}
+
+/*
+ * Number of iterations, counting the first, before v1 + m * delta leaves
+ * [0, 2^32).
+ */
+static uint64_t wrapDistance(uint64_t v1, int32_t delta)
+{
+	if (delta > 0) {
+		return (UINT32_MAX - v1) / delta + 1;
+	}
+	if (delta < 0) {
+		return v1 / -(int64_t)delta + 1;
+	}
+	return NEVER;
+}
+
+/*
+ * Number of further iterations before e1 + m * de changes sign (negative,
+ * zero or positive), which is when the flags a compare sets change.
+ */
+static uint64_t signDistance(int64_t e1, int64_t de)
+{
+	if (de == 0) {
+		return NEVER;
+	}
+	if (e1 == 0) {
+		return 1;
+	}
+	if (e1 < 0 && de > 0) {
+		return (-e1 + de - 1) / de;
+	}
+	if (e1 > 0 && de < 0) {
+		return (e1 - de - 1) / -de;
+	}
+	return NEVER;
+}
+
+uint64_t idleSkip(struct cpuState *cpu, uint32_t branchPC, uint64_t maxInstructions)
+{
+	struct instruction body[IDLE_MAX_BODY];
+	Compare compares[IDLE_MAX_BODY];
+	uint32_t delta[NUM_REGISTERS];
+	uint32_t s1[NUM_REGISTERS];
+	uint32_t s2[NUM_REGISTERS];
+	uint32_t head = cpu->pc;
+	uint64_t iterations = NEVER;
+	int numCompares;
+	int n, i;
+
+	if ((branchPC < head) || (branchPC - head) / 8 >= IDLE_MAX_BODY ||
+		((branchPC - head) % 8) != 0 || branchPC + 8 > cpu->memSize) {
+		return 0;
+	}
+	n = (branchPC - head) / 8 + 1;
+	if (maxInstructions / n < 2 || maxInstructions < IDLE_MIN_SKIP) {
+		return 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		decode(cpu->mem + head + 8 * i, &body[i]);
+	}
+	if ((numCompares = analyse(cpu, body, n, head, delta, compares)) < 0) {
+		return 0;
+	}
+
+	/*
+	 * Run the next two iterations for real to confirm the progression.
+	 */
+	memcpy(s1, cpu->r, sizeof(s1));
+	if (dryRun(body, n, s1) < 0) {
+		return 0;
+	}
+	memcpy(s2, s1, sizeof(s2));
+	if (dryRun(body, n, s2) < 0) {
+		return 0;
+	}
+	for (i = 0; i < NUM_REGISTERS; i++) {
+		if (i != R_FL && s2[i] - s1[i] != delta[i]) {
+			return 0;
+		}
+	}
+
+	/*
+	 * Iteration k (counting the one starting from s1 as 1) takes the same
+	 * path as long as no compare changes its outcome and no compared
+	 * value wraps around.
+	 */
+	for (i = 0; i < numCompares; i++) {
+		Compare *c = &compares[i];
+		uint32_t da = c->a.reg < 0 ? 0 : delta[c->a.reg];
+		uint32_t db = c->b.reg < 0 ? 0 : delta[c->b.reg];
+		uint64_t a1 = valueAt(s1, &c->a);
+		uint64_t b1 = valueAt(s1, &c->b);
+		uint64_t m;
+
+		m = signDistance((int64_t)a1 - (int64_t)b1, (int64_t)(int32_t)da - (int64_t)(int32_t)db);
+		if (wrapDistance(a1, da) < m) {
+			m = wrapDistance(a1, da);
+		}
+		if (wrapDistance(b1, db) < m) {
+			m = wrapDistance(b1, db);
+		}
+		if (m < iterations) {
+			iterations = m;
+		}
+	}
+
+	/*
+	 * Iterations 1 .. iterations are known to loop back, skip all but the
+	 * last of them.
+	 */
+	if (iterations > maxInstructions / n) {
+		iterations = maxInstructions / n;
+	}
+	if (iterations < 2 || iterations * n < IDLE_MIN_SKIP) {
+		return 0;
+	}
+
+	/*
+	 * Jump to the top of iteration 'iterations - 1' and run it to get the
+	 * flags exactly as the guest would see them.
+	 */
+	for (i = 0; i < NUM_REGISTERS; i++) {
+		s2[i] = s1[i] + (uint32_t)(iterations - 2) * delta[i];
+	}
+	s2[R_FL] = s1[R_FL];
+	if (dryRun(body, n, s2) < 0) {
+		return 0;
+	}
+
+	for (i = 0; i < NUM_REGISTERS; i++) {
+		if (i != R_C1 && i != R_C2) {
+			cpu->r[i] = s2[i];
+		}
+	}
+
+	loopsSkipped++;
+	instructionsSkipped += iterations * n;
+
+	return iterations * n;
+}
+
+void idleReport(FILE *stream)
+{
+	fprintf(stream, "\nFast-forward: %" PRIu64 " idle loops, %" PRIu64 " instructions skipped\n",
+	        loopsSkipped, instructionsSkipped);
+}
@@ -0,0 +1,44 @@
+#ifndef __IDLE_H
+#define __IDLE_H
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+/*
+ * Reads 'size' (1 or 4) bytes at 'address' without any side effect and
+ * stores them in host order in 'value'.
+ *
+ * On success, returns 0.
+ * If the location can't be read that way, returns -1.
+ */
+typedef int (*idlePeekFn)(uint32_t address, uint32_t size, uint32_t *value);
+
+/*
+ * Enable idle loop detection. Guest loads performed while analysing a
+ * loop go through 'peek'.
+ */
+void idleInit(idlePeekFn peek);
+
+/*
+ * Called after the branch at 'branchPC' jumped back to cpu->pc. If the
+ * loop between cpu->pc and 'branchPC' is a short, store free loop whose
+ * exit only depends on the cycle counters, on induction variables or on
+ * values it polls from memory, compute how many iterations it will keep
+ * spinning and move the registers (except r14/r15) directly to the state
+ * they would have after them.
+ *
+ * At most 'maxInstructions' instructions are skipped, so the caller can
+ * stop short of the next timer or device event.
+ *
+ * Returns the number of instructions skipped, the caller accounts for
+ * them in ic, r14/r15, timers and the cycle limit.
+ */
+uint64_t idleSkip(struct cpuState *cpu, uint32_t branchPC, uint64_t maxInstructions);
+
+/*
+ * Print how many loops and instructions were skipped.
+ */
+void idleReport(FILE *stream);
+
+#endif /* __IDLE_H */
@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "spi.h"
+
+/*
+ * 128x64 graphic LCD with an ST7920 controller in serial mode (SPI mode
+ * 3). Each write is three bytes: a sync byte (0xF8 for an instruction,
+ * 0xFA for data) and the high and low nibbles of the value, each in the
+ * upper half of a byte. The serial interface is write only.
+ *
+ * Both the text (DDRAM) and graphics (GDRAM) memories are kept. At
+ * exit, the graphics are written to a PBM image and the text lines are
+ * printed with the report.
+ */
+#define LCD_WIDTH        128
+#define LCD_HEIGHT       64
+#define LCD_LINES        4
+#define LCD_COLUMNS      16
+
+#define SYNC_MASK        0xF9
+#define SYNC             0xF8
+#define SYNC_RW          0x04
+#define SYNC_RS          0x02
+
+#define FUNCTION_SET     0x20
+#define FUNCTION_RE      0x04
+#define FUNCTION_GRAPHIC 0x02
+#define DISPLAY_CONTROL  0x08
+#define DISPLAY_ON       0x04
+
+static char *imagePath;
+
+static int selected;
+static uint8_t sync;
+static uint8_t value;
+static int received;
+
+static int extended;
+static int graphicsOn;
+static int displayOn;
+
+/*
+ * DDRAM has 32 addresses of two characters. GDRAM is addressed as 32
+ * rows of 16 words by 'gdramY' and 'gdramX', words 8 to 15 of a row are
+ * the lower half of the screen.
+ */
+static char text[LCD_LINES][LCD_COLUMNS];
+static uint8_t ddramAddress;
+static int ddramLow;
+static uint8_t graphics[LCD_HEIGHT][LCD_WIDTH / 8];
+static uint8_t gdramX;
+static uint8_t gdramY;
+static int gdramAddressWrites;
+static int gdramLow;
+
+static uint64_t instructions;
+static uint64_t dataWrites;
+
+static int lcdOpen(char *config)
+{
+	if (config != NULL && (imagePath = strdup(config)) == NULL) {
+		return -1;
+	}
+	memset(text, ' ', sizeof(text));
+
+	return 0;
+}
+
+static int writeImage()
+{
+	FILE *f;
+
+	if ((f = fopen(imagePath, "w")) == NULL) {
+		fprintf(stderr, "Can't write LCD image '%s': %s\n", imagePath, strerror(errno));
+		return -1;
+	}
+
+	/*
+	 * PBM rows are packed MSB first, the same as GDRAM.
+	 */
+	fprintf(f, "P4\n%d %d\n", LCD_WIDTH, LCD_HEIGHT);
+	fwrite(graphics, 1, sizeof(graphics), f);
+	fclose(f);
+
+	return 0;
+}
+
+static void lcdClose()
+{
+	if (imagePath != NULL) {
+		writeImage();
+		free(imagePath);
+		imagePath = NULL;
+	}
+}
+
+static void lcdReport(FILE *f)
+{
+	int i;
+
+	fprintf(f, "LCD: %" PRIu64 " instructions, %" PRIu64 " data writes, display %s%s\n",
+	        instructions, dataWrites, displayOn ? "on" : "off",
+	        graphicsOn ? ", graphics on" : "");
+	for (i = 0; i < LCD_LINES; i++) {
+		fprintf(f, "  |%.*s|\n", LCD_COLUMNS, text[i]);
+	}
+}
+
+static void lcdSelect(int active)
+{
+	selected = active;
+	received = 0;
+}
+
+static void instruction(uint8_t i)
+{
+	instructions++;
+
+	if ((i & 0xE0) == FUNCTION_SET) {
+		extended = (i & FUNCTION_RE) != 0;
+		if (extended) {
+			graphicsOn = (i & FUNCTION_GRAPHIC) != 0;
+		}
+		return;
+	}
+
+	if (extended) {
+		/*
+		 * Set GDRAM address: vertical first, then horizontal.
+		 */
+		if (i & 0x80) {
+			if (gdramAddressWrites++ == 0) {
+				gdramY = i & 0x1F;
+			} else {
+				gdramX = i & 0x0F;
+				gdramAddressWrites = 0;
+				gdramLow = 0;
+			}
+		}
+		return;
+	}
+
+	if (i & 0x80) {
+		ddramAddress = i & 0x1F;
+		ddramLow = 0;
+	} else if ((i & 0xF8) == DISPLAY_CONTROL) {
+		displayOn = (i & DISPLAY_ON) != 0;
+	} else if (i == 0x01) {
+		memset(text, ' ', sizeof(text));
+		ddramAddress = 0;
+		ddramLow = 0;
+	} else if ((i & 0xFE) == 0x02) {
+		ddramAddress = 0;
+		ddramLow = 0;
+	}
+}
+
+static void data(uint8_t d)
+{
+	int line, column;
+
+	dataWrites++;
+
+	if (extended) {
+		/*
+		 * Two bytes per word, the address moves on after the second.
+		 */
+		line = gdramY + (gdramX >= 8 ? 32 : 0);
+		column = (gdramX & 0x7) * 2 + gdramLow;
+		graphics[line][column] = d;
+		if (gdramLow) {
+			gdramX = (gdramX + 1) & 0xF;
+		}
+		gdramLow = !gdramLow;
+		return;
+	}
+
+	/*
+	 * DDRAM lines are at 0x00, 0x10, 0x08 and 0x18.
+	 */
+	line = ((ddramAddress & 0x10) ? 1 : 0) + ((ddramAddress & 0x08) ? 2 : 0);
+	column = (ddramAddress & 0x7) * 2 + ddramLow;
+	text[line][column] = (d >= 0x20 && d < 0x7F) ? d : '?';
+	if (ddramLow) {
+		ddramAddress = (ddramAddress + 1) & 0x1F;
+	}
+	ddramLow = !ddramLow;
+}
+
+static uint8_t lcdExchange(uint8_t byte)
+{
+	if (!selected) {
+		return 0xFF;
+	}
+
+	/*
+	 * A sync byte always starts a new write, so the host can recover
+	 * from a partial one.
+	 */
+	if ((byte & SYNC_MASK) == SYNC) {
+		sync = byte;
+		received = 1;
+		return 0xFF;
+	}
+
+	switch (received) {
+		case 1:
+			value = byte & 0xF0;
+			received = 2;
+			break;
+		case 2:
+			value |= byte >> 4;
+			received = 0;
+			if (sync & SYNC_RW) {
+				break;
+			}
+			if (sync & SYNC_RS) {
+				data(value);
+			} else {
+				instruction(value);
+			}
+			break;
+	}
+
+	return 0xFF;
+}
+
+struct spiSlave lcdSlave = {
+	"lcd",
+	3,
+	lcdOpen,
+	lcdSelect,
+	lcdExchange,
+	lcdReport,
+	lcdClose,
+};
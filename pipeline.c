@@ -0,0 +1,269 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "pipeline.h"
+#include "symbols.h"
+#include "isa.h"
+
+/*
+ * Instructions flow through IF ID EX MEM WB, one per clock. Rather than
+ * moving instructions between stage latches, the model only remembers
+ * the clock each instruction enters EX and the clock each register's
+ * new value can first be consumed by a later EX.
+ *
+ * The register file is written in the first half of WB and read in the
+ * second half of ID, so without forwarding a consumer can enter EX the
+ * clock after its producer's WB. With forwarding, ALU results are
+ * bypassed from EX/MEM and loaded values from MEM/WB.
+ *
+ * Branches resolve in EX; an unconditional immediate jmp resolves in ID.
+ */
+#define FIRST_EX         3
+#define DRAIN            2
+#define READY_NOFORWARD  3
+#define READY_ALU        1
+#define READY_LOAD       2
+#define JMP_PENALTY      1
+
+#define REG(x)           (1u << (x))
+
+typedef struct PipelineStats
+{
+	uint64_t instructions;
+	uint64_t dataStalls;
+	uint64_t loadUseStalls;
+	uint64_t controlStalls;
+} PipelineStats;
+
+static int forwarding = 1;
+static uint32_t flushPenalty = 2;
+
+static uint64_t lastEX;
+static uint64_t nextEX = FIRST_EX;
+static uint64_t ready[NUM_REGISTERS];
+static uint8_t loadedBy[NUM_REGISTERS];
+
+/*
+ * Per function statistics, indexed by symbol. The last entry collects
+ * instructions outside of any known function.
+ */
+static PipelineStats *functionStats;
+static PipelineStats total;
+static int numFunctions;
+
+int pipelineInit(char *config)
+{
+	char *copy, *option, *save;
+
+	if (config != NULL) {
+		copy = strdup(config);
+		for (option = strtok_r(copy, ",", &save); option != NULL;
+			 option = strtok_r(NULL, ",", &save)) {
+			if (strcmp(option, "noforward") == 0) {
+				forwarding = 0;
+			} else if (sscanf(option, "flush=%" SCNu32, &flushPenalty) != 1) {
+				fprintf(stderr, "Unknown pipeline option '%s' (noforward, flush=<n>)\n", option);
+				free(copy);
+				return -1;
+			}
+		}
+		free(copy);
+	}
+
+	/*
+	 * Symbols are loaded before the pipeline is configured.
+	 */
+	numFunctions = symbolsCount();
+	if ((functionStats = calloc(numFunctions + 1, sizeof(*functionStats))) == NULL) {
+		fprintf(stderr, "Can't allocate pipeline statistics: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Decode which registers an instruction reads in EX, reads in MEM (store
+ * data) and writes.
+ */
+static void decodeRegisters(struct instruction *o, uint32_t *exReads, uint32_t *memReads, uint32_t *writes)
+{
+	uint32_t operand = (o->mode & MODE_OPERAND) == OPR_REG ? REG(o->raw2 & 0xF) : 0;
+	uint32_t base = (o->mode & MODE_ADDRESS) == ADDR_REL ? REG(R_BA) : 0;
+
+	*exReads = *memReads = *writes = 0;
+
+	switch (o->op) {
+		case add:
+		case adc:
+			*exReads = REG(o->reg1) | operand | (o->op == adc ? REG(R_FL) : 0);
+			*writes = REG(o->reg0) | REG(R_FL);
+			break;
+		case sub:
+		case sbc:
+		case mul:
+		case div:
+		case and:
+		case or:
+		case xor:
+		case nor:
+		case lsl:
+		case lsr:
+			*exReads = REG(o->reg1) | operand;
+			*writes = REG(o->reg0);
+			break;
+		case mov:
+			*exReads = operand;
+			*writes = REG(o->reg0);
+			break;
+		case ldw:
+		case ldb:
+			*exReads = operand | base;
+			*writes = REG(o->reg0);
+			break;
+		case stw:
+		case stb:
+			*exReads = REG(o->reg0) | base;
+			*memReads = operand;
+			break;
+		case cmp:
+			*exReads = REG(o->reg0) | operand;
+			*writes = REG(R_FL);
+			break;
+		case jmp:
+			*exReads = operand | base;
+			break;
+		case jz:
+		case jnz:
+		case jl:
+		case jge:
+			*exReads = operand | base | REG(R_FL);
+			break;
+	}
+
+	/*
+	 * The cycle counters are advanced by hardware every instruction and
+	 * never stall the pipeline.
+	 */
+	*writes &= ~(REG(R_C1) | REG(R_C2));
+}
+
+void pipelineInstruction(uint32_t pc, struct instruction *o, int taken, int mispredicted)
+{
+	PipelineStats *stats;
+	uint32_t exReads, memReads, writes;
+	uint64_t earliest = nextEX;
+	uint64_t dataReady = nextEX;
+	int loadUse = 0;
+	int s = symbolsFind(pc);
+	int i;
+
+	stats = &functionStats[s < 0 ? numFunctions : s];
+	decodeRegisters(o, &exReads, &memReads, &writes);
+
+	for (i = 0; i < NUM_REGISTERS; i++) {
+		uint64_t need;
+
+		if (((exReads | memReads) & REG(i)) == 0) {
+			continue;
+		}
+		/*
+		 * Store data is only needed one stage later, in MEM.
+		 */
+		need = ((exReads & REG(i)) || ready[i] == 0) ? ready[i] : ready[i] - 1;
+		if (need > dataReady) {
+			dataReady = need;
+			loadUse = loadedBy[i];
+		}
+	}
+
+	/*
+	 * Stalls behind a branch flush are control stalls; anything beyond
+	 * that is waiting on data.
+	 */
+	lastEX = dataReady;
+	if (dataReady > earliest) {
+		if (loadUse && forwarding) {
+			stats->loadUseStalls += dataReady - earliest;
+			total.loadUseStalls += dataReady - earliest;
+		} else {
+			stats->dataStalls += dataReady - earliest;
+			total.dataStalls += dataReady - earliest;
+		}
+	}
+
+	for (i = 0; i < NUM_REGISTERS; i++) {
+		if (writes & REG(i)) {
+			int load = (o->op == ldw) || (o->op == ldb);
+
+			ready[i] = lastEX + (!forwarding ? READY_NOFORWARD : load ? READY_LOAD : READY_ALU);
+			loadedBy[i] = load;
+		}
+	}
+
+	stats->instructions++;
+	total.instructions++;
+	nextEX = lastEX + 1;
+
+	if ((o->op >= jmp) && (o->op <= jge)) {
+		uint32_t penalty = 0;
+
+		if (mispredicted >= 0) {
+			penalty = mispredicted ? flushPenalty : 0;
+		} else if (o->op == jmp && (o->mode & MODE_OPERAND) == OPR_IMM) {
+			penalty = JMP_PENALTY;
+		} else if (taken) {
+			penalty = flushPenalty;
+		}
+
+		/*
+		 * The flush is charged to the branch's function.
+		 */
+		stats->controlStalls += penalty;
+		total.controlStalls += penalty;
+		nextEX += penalty;
+	}
+}
+
+static uint64_t stallCycles(PipelineStats *stats)
+{
+	return stats->dataStalls + stats->loadUseStalls + stats->controlStalls;
+}
+
+void pipelineReport(FILE *stream)
+{
+	uint64_t cycles = total.instructions == 0 ? 0 : lastEX + DRAIN;
+	int i;
+
+	fprintf(stream, "\nPipeline model (5 stages, %s, %" PRIu32 " clock branch flush):\n",
+	        forwarding ? "forwarding" : "no forwarding", flushPenalty);
+	fprintf(stream, "    %" PRIu64 " instructions, %" PRIu64 " clocks, CPI %.3f\n",
+	        total.instructions, cycles,
+	        total.instructions == 0 ? 0.0 : (double)cycles / total.instructions);
+	fprintf(stream, "    stalls: %" PRIu64 " data, %" PRIu64 " load-use, %" PRIu64 " control\n",
+	        total.dataStalls, total.loadUseStalls, total.controlStalls);
+
+	fprintf(stream, "\n%-20s %12s %7s %10s %10s %10s\n", "function",
+	        "instructions", "CPI", "data", "load-use", "control");
+	for (i = 0; i <= numFunctions; i++) {
+		PipelineStats *stats = &functionStats[i];
+
+		if (stats->instructions == 0) {
+			continue;
+		}
+		fprintf(stream, "%-20s %12" PRIu64 " %7.3f %10" PRIu64 " %10" PRIu64 " %10" PRIu64 "\n",
+		        i == numFunctions ? "(unknown)" : symbolsName(i),
+		        stats->instructions,
+		        (double)(stats->instructions + stallCycles(stats)) / stats->instructions,
+		        stats->dataStalls, stats->loadUseStalls, stats->controlStalls);
+	}
+}
+
+void pipelineFree()
+{
+	free(functionStats);
+	functionStats = NULL;
+}
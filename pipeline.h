@@ -0,0 +1,38 @@
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+/*
+ * Model a classic in-order 5 stage pipeline (IF ID EX MEM WB) on top of
+ * the executed instruction stream. 'config' is NULL or a comma
+ * separated list of:
+ *
+ *     noforward  Results are only visible after WB.
+ *     flush=<n>  Cycles lost on a taken or mispredicted branch (default 2).
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int pipelineInit(char *config);
+
+/*
+ * Account for one executed instruction. 'mispredicted' is the branch
+ * predictor's verdict or -1 when no predictor is simulated, in which
+ * case branches are predicted not taken.
+ */
+void pipelineInstruction(uint32_t pc, struct instruction *o, int taken, int mispredicted);
+
+/*
+ * Print CPI and the stall breakdown in total and per .sym function.
+ */
+void pipelineReport(FILE *stream);
+
+/*
+ * Release the per-function statistics.
+ */
+void pipelineFree();
+
+#endif /* __PIPELINE_H */
@@ -0,0 +1,175 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include "profile.h"
+#include "symbols.h"
+#include "debugger.h"
+
+#define PROFILE_TOP_LINES 20
+
+/*
+ * One counter per 4 byte aligned PC (binaries may start instructions on
+ * a 4 byte boundary), so the signal handler only has to increment a
+ * counter. Pages of the table that are never sampled are never touched.
+ */
+static uint32_t *samples;
+static uint32_t sampleSlots;
+static uint64_t sampleCount;
+static long sampleInterval;
+
+static volatile uint32_t *samplePC;
+
+struct hotSpot {
+	uint32_t pc;
+	uint32_t count;
+};
+
+static void sampleHandler(int signal)
+{
+	uint32_t slot = *samplePC >> 2;
+
+	if (slot < sampleSlots) {
+		samples[slot]++;
+	}
+	sampleCount++;
+}
+
+int profileStart(struct cpuState *cpu, long interval)
+{
+	struct sigaction action;
+	struct itimerval timer;
+
+	sampleSlots = cpu->memSize >> 2;
+	if ((samples = calloc(sampleSlots, sizeof(*samples))) == NULL) {
+		fprintf(stderr, "Can't allocate profile samples: %s\n", strerror(errno));
+		return -1;
+	}
+	samplePC = &cpu->pc;
+	sampleInterval = interval;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = sampleHandler;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+
+	if (sigaction(SIGPROF, &action, NULL) < 0) {
+		fprintf(stderr, "Can't catch SIGPROF: %s\n", strerror(errno));
+		return -1;
+	}
+
+	timer.it_interval.tv_sec = interval / 1000000;
+	timer.it_interval.tv_usec = interval % 1000000;
+	timer.it_value = timer.it_interval;
+
+	if (setitimer(ITIMER_PROF, &timer, NULL) < 0) {
+		fprintf(stderr, "Can't start profile timer: %s\n", strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static int compareHotSpots(const void *a, const void *b)
+{
+	const struct hotSpot *l = a;
+	const struct hotSpot *r = b;
+
+	if (l->count != r->count) {
+		return l->count < r->count ? 1 : -1;
+	}
+	return l->pc < r->pc ? -1 : l->pc > r->pc;
+}
+
+void profileStop(FILE *stream)
+{
+	struct itimerval timer;
+	struct hotSpot *spots;
+	struct hotSpot *functions;
+	uint32_t slot;
+	int numSpots = 0;
+	int numFunctions = symbolsCount();
+	int i;
+
+	if (samples == NULL) {
+		return;
+	}
+
+	memset(&timer, 0, sizeof(timer));
+	setitimer(ITIMER_PROF, &timer, NULL);
+	signal(SIGPROF, SIG_DFL);
+
+	/*
+	 * Collect every sampled instruction and sum them per function.
+	 * The extra function slot collects PCs outside of any label.
+	 */
+	for (slot = 0; slot < sampleSlots; slot++) {
+		if (samples[slot] != 0) {
+			numSpots++;
+		}
+	}
+	spots = calloc(numSpots + 1, sizeof(*spots));
+	functions = calloc(numFunctions + 1, sizeof(*functions));
+	if (spots == NULL || functions == NULL) {
+		fprintf(stderr, "Can't allocate profile report: %s\n", strerror(errno));
+		goto DONE;
+	}
+	for (i = 0; i <= numFunctions; i++) {
+		functions[i].pc = i;
+	}
+
+	numSpots = 0;
+	for (slot = 0; slot < sampleSlots; slot++) {
+		if (samples[slot] == 0) {
+			continue;
+		}
+		spots[numSpots].pc = slot << 2;
+		spots[numSpots].count = samples[slot];
+
+		i = symbolsFind(slot << 2);
+		functions[i < 0 ? numFunctions : i].count += samples[slot];
+		numSpots++;
+	}
+
+	qsort(spots, numSpots, sizeof(*spots), compareHotSpots);
+	qsort(functions, numFunctions + 1, sizeof(*functions), compareHotSpots);
+
+	fprintf(stream, "\nProfile: %" PRIu64 " samples every %ld us\n", sampleCount, sampleInterval);
+	if (sampleCount == 0) {
+		goto DONE;
+	}
+
+	fprintf(stream, "\n%10s %7s  %s\n", "samples", "%", "function");
+	for (i = 0; i <= numFunctions && functions[i].count != 0; i++) {
+		fprintf(stream, "%10" PRIu32 " %6.2f%%  %s\n", functions[i].count,
+		        100.0 * functions[i].count / sampleCount,
+		        functions[i].pc == numFunctions ? "(unknown)" : symbolsName(functions[i].pc));
+	}
+
+	fprintf(stream, "\n%10s %7s  %-10s %s\n", "samples", "%", "pc", "source");
+	for (i = 0; i < numSpots && i < PROFILE_TOP_LINES; i++) {
+		char *file;
+		int line;
+		int s = symbolsFind(spots[i].pc);
+
+		fprintf(stream, "%10" PRIu32 " %6.2f%%  0x%-8" PRIX32, spots[i].count,
+		        100.0 * spots[i].count / sampleCount, spots[i].pc);
+		if (mapOffsetToLine(spots[i].pc, &file, &line) == 0) {
+			fprintf(stream, " %s:%d", file, line);
+		}
+		if (s >= 0) {
+			fprintf(stream, " (%s+0x%" PRIX32 ")", symbolsName(s), spots[i].pc - symbolsAddress(s));
+		}
+		fprintf(stream, "\n");
+	}
+
+DONE:
+	free(spots);
+	free(functions);
+	free(samples);
+	samples = NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+/*
+ * Sample the guest PC every 'interval' microseconds of host CPU time
+ * using setitimer(ITIMER_PROF) and a SIGPROF handler.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int profileStart(struct cpuState *cpu, long interval);
+
+/*
+ * Stop sampling, then aggregate the samples per function (.sym labels)
+ * and per source line (*.debug info) and print the hot spots.
+ */
+void profileStop(FILE *stream);
+
+#endif /* __PROFILE_H */
@@ -0,0 +1,40 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;
+; Block device example (emulator only, run with --disk sd.img).
+;
+; Read the first two sectors of the disk (the file system super block and
+; first headers) to 0x6000 and wait for the transfer by polling the
+; status register.
+;
+
+.block_lba      0x20BC
+.block_buffer   0x20C0
+.block_count    0x20C4
+.block_command  0x20C8
+.block_status   0x20CC
+
+.block_read     1
+.block_done     2
+
+mov ba 0
+
+mov r0 0
+mov r6 .block_lba
+stw @r6 r0
+mov r0 0x6000
+mov r6 .block_buffer
+stw @r6 r0
+mov r0 2
+mov r6 .block_count
+stw @r6 r0
+mov r0 .block_read
+mov r6 .block_command
+stw @r6 r0
+
+.wait
+ldw r1 @.block_status
+and r1 r1 .block_done
+cmp r1 0
+jz .wait
+
+die
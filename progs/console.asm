@@ -0,0 +1,40 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;
+; Console example (emulator only, run with --console=-,<inputPath>).
+; Assemble with -s 0x4000 and load at 0x4000.
+;
+; Print "ok" and a new line, then copy every received byte back to the
+; output until the input ends.
+;
+
+.console_data    0x20D4
+.console_status  0x20D8
+
+.console_rx_ready 1
+.console_rx_eof   4
+
+mov ba 0
+
+mov r6 .console_data
+mov r0 0x6F
+stb @r6 r0
+mov r0 0x6B
+stb @r6 r0
+mov r0 0x0A
+stb @r6 r0
+
+.poll
+ldw r1 @.console_status
+and r2 r1 .console_rx_eof
+cmp r2 0
+jnz .done
+and r2 r1 .console_rx_ready
+cmp r2 0
+jz .poll
+
+ldb r0 @r6
+stb @r6 r0
+jmp .poll
+
+.done
+die
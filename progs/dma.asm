@@ -0,0 +1,67 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;
+; DMA engine example (emulator only).
+;
+; Fill 0x1000 bytes at 0x6000 with 0xAB, copy them to 0x7000 and wait for
+; each transfer by polling the status register.
+;
+
+.dma_source      0x20A8
+.dma_destination 0x20AC
+.dma_length      0x20B0
+.dma_mode        0x20B4
+.dma_control     0x20B8
+
+.dma_fill        1
+.dma_start       1
+.dma_done        2
+
+mov ba 0
+
+; fill
+mov r0 0xAB
+mov r6 .dma_source
+stw @r6 r0
+mov r0 0x6000
+mov r6 .dma_destination
+stw @r6 r0
+mov r0 0x1000
+mov r6 .dma_length
+stw @r6 r0
+mov r0 .dma_fill
+mov r6 .dma_mode
+stw @r6 r0
+mov r0 .dma_start
+mov r6 .dma_control
+stw @r6 r0
+
+.wait_fill
+ldw r1 @.dma_control
+and r1 r1 .dma_done
+cmp r1 0
+jz .wait_fill
+
+; copy
+mov r0 0x6000
+mov r6 .dma_source
+stw @r6 r0
+mov r0 0x7000
+mov r6 .dma_destination
+stw @r6 r0
+mov r0 0x1000
+mov r6 .dma_length
+stw @r6 r0
+mov r0 0
+mov r6 .dma_mode
+stw @r6 r0
+mov r0 .dma_start
+mov r6 .dma_control
+stw @r6 r0
+
+.wait_copy
+ldw r1 @.dma_control
+and r1 r1 .dma_done
+cmp r1 0
+jz .wait_copy
+
+die
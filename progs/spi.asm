@@ -0,0 +1,166 @@
+;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+;
+; SPI SD card example (emulator only, run with --spi sd=sd.img).
+; Assemble with -s 0x4000 and load at 0x4000.
+;
+; Initialize the card on select line 0 and read sector 1 (the first
+; file system headers) to 0x6000. Commands and the data block move in
+; bursts, responses are polled for one byte at a time.
+;
+
+.spi_control       0x209C
+.spi_input         0x20A0
+.spi_output        0x20A4
+.spi_burst_address 0x20E0
+.spi_burst_length  0x20E4
+.spi_burst_control 0x20E8
+
+.spi_busy          0x10000
+.select_sd         0x100
+.burst_send        1
+.burst_receive     3
+.burst_done        2
+
+mov ba 0
+
+; select the card in mode 0
+mov r0 .select_sd
+mov r6 .spi_control
+stw @r6 r0
+
+mov r1 .cmd0
+mov r5 .ra_cmd0
+jmp .command
+.ra_cmd0
+mov r1 .cmd8
+mov r5 .ra_cmd8
+jmp .command
+.ra_cmd8
+
+; repeat ACMD41 until the card leaves the idle state
+.init
+mov r1 .cmd55
+mov r5 .ra_cmd55
+jmp .command
+.ra_cmd55
+mov r1 .acmd41
+mov r5 .ra_acmd41
+jmp .command
+.ra_acmd41
+cmp r3 0
+jnz .init
+
+mov r1 .cmd17
+mov r5 .ra_cmd17
+jmp .command
+.ra_cmd17
+
+; wait for the data token, then receive the block and its CRC
+.token
+mov r5 .ra_token
+jmp .exchange
+.ra_token
+cmp r3 0xFE
+jnz .token
+
+mov r0 0x6000
+mov r1 512
+mov r2 .burst_receive
+mov r5 .ra_block
+jmp .burst
+.ra_block
+mov r0 .crc
+mov r1 2
+mov r2 .burst_receive
+mov r5 .ra_crc
+jmp .burst
+.ra_crc
+
+die
+
+; Send the 6 byte command at r1 and return its R1 response in r3.
+.command
+	mov r0 r1
+	mov r1 6
+	mov r2 .burst_send
+	mov r4 r5
+	mov r5 .__command_sent
+	jmp .burst
+.__command_sent
+	mov r5 r4
+.__command_poll
+	mov r4 r5
+	mov r5 .__command_byte
+	jmp .exchange
+.__command_byte
+	mov r5 r4
+	cmp r3 0xFF
+	jz .__command_poll
+	jmp r5
+
+; Burst r1 bytes at r0 with burst control r2, wait for it to finish.
+.burst
+	mov r6 .spi_burst_address
+	stw @r6 r0
+	mov r6 .spi_burst_length
+	stw @r6 r1
+	mov r6 .spi_burst_control
+	stw @r6 r2
+.__burst_wait
+	ldw r3 @.spi_burst_control
+	and r3 r3 .burst_done
+	cmp r3 0
+	jz .__burst_wait
+	jmp r5
+
+; Clock one byte out of the card into r3.
+.exchange
+	mov r3 0xFF
+	mov r6 .spi_input
+	stw @r6 r3
+.__exchange_wait
+	ldw r3 @.spi_control
+	and r3 r3 .spi_busy
+	cmp r3 0
+	jnz .__exchange_wait
+	ldw r3 @.spi_output
+	jmp r5
+
+.cmd0
+b 0x40
+b 0
+b 0
+b 0
+b 0
+b 0x95
+.cmd8
+b 0x48
+b 0
+b 0
+b 0x01
+b 0xAA
+b 0x87
+.cmd55
+b 0x77
+b 0
+b 0
+b 0
+b 0
+b 0x01
+.acmd41
+b 0x69
+b 0x40
+b 0
+b 0
+b 0
+b 0x01
+.cmd17
+b 0x51
+b 0
+b 0
+b 0
+b 0x01
+b 0x01
+.crc
+b 0
+b 0
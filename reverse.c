@@ -0,0 +1,292 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "reverse.h"
+
+#define DEFAULT_INTERVAL 100000
+#define DEFAULT_BUDGET   64
+
+#define NONE UINT64_MAX
+
+struct savedPage {
+	uint32_t page;
+	struct savedPage *next;
+	uint8_t data[REVERSE_PAGE_SIZE];
+};
+
+/*
+ * The state at one point and the pages written after it, as they were
+ * at that point.
+ */
+struct checkpoint {
+	struct cpuState state;
+	struct savedPage *pages;
+};
+
+enum phase {
+	PHASE_IDLE,
+	PHASE_SEARCH,
+	PHASE_GOTO,
+};
+
+uint8_t *reverseSaved;
+uint64_t reverseNext;
+
+static struct cpuState *reverseCPU;
+static uint64_t interval;
+static uint64_t budget;
+static uint64_t used;
+static uint32_t savedBytes;
+
+/*
+ * Oldest first.
+ */
+static struct checkpoint *checkpoints;
+static int count;
+static int capacity;
+
+/*
+ * A reverse command runs the segments between checkpoints forward again,
+ * newest first, until one has an instruction where the command should
+ * stop. 'found' is the last such instruction of the segment being run,
+ * which then runs again up to it.
+ */
+static enum phase phase;
+static int searchMode;
+static int segment;
+static uint64_t segmentEnd;
+static uint64_t found;
+static uint64_t target;
+
+int reverseInit(struct cpuState *cpu, char *config)
+{
+	char *end;
+
+	reverseCPU = cpu;
+	interval = DEFAULT_INTERVAL;
+	budget = DEFAULT_BUDGET;
+
+	if (config != NULL) {
+		if (*config != ',' && *config != '\0') {
+			interval = strtoull(config, &end, 0);
+			config = end;
+		}
+		if (*config == ',') {
+			budget = strtoull(config + 1, &end, 0);
+			config = end;
+		}
+		if (*config != '\0' || interval == 0 || budget == 0) {
+			fprintf(stderr, "Reverse format: [<interval>][,<budget MB>]\n");
+			return -1;
+		}
+	}
+	budget *= 1024 * 1024;
+
+	savedBytes = (cpu->memSize >> REVERSE_PAGE_SHIFT) / 8 + 1;
+	if ((reverseSaved = calloc(1, savedBytes)) == NULL) {
+		fprintf(stderr, "Can't allocate reverse page map: %s\n", strerror(errno));
+		return -1;
+	}
+	reverseNext = cpu->ic;
+
+	return 0;
+}
+
+static void freePages(struct checkpoint *c)
+{
+	struct savedPage *p;
+
+	while ((p = c->pages) != NULL) {
+		c->pages = p->next;
+		used -= sizeof(*p);
+		free(p);
+	}
+}
+
+static void dropOldest()
+{
+	freePages(&checkpoints[0]);
+	used -= sizeof(*checkpoints);
+	memmove(checkpoints, checkpoints + 1, --count * sizeof(*checkpoints));
+}
+
+/*
+ * Drop the oldest checkpoints while over the budget. A reverse command
+ * keeps the one it runs from.
+ */
+static void trim()
+{
+	while (used > budget && count > 1) {
+		if (phase != PHASE_IDLE) {
+			if (segment == 0) {
+				return;
+			}
+			segment--;
+		}
+		dropOldest();
+	}
+}
+
+void reverseFree()
+{
+	while (count > 0) {
+		dropOldest();
+	}
+	free(checkpoints);
+	checkpoints = NULL;
+	capacity = 0;
+	free(reverseSaved);
+	reverseSaved = NULL;
+}
+
+void reverseCheckpoint()
+{
+	struct checkpoint *c;
+
+	reverseNext = reverseCPU->ic + interval;
+
+	if (count == capacity) {
+		capacity = capacity ? capacity * 2 : 16;
+		if ((c = realloc(checkpoints, capacity * sizeof(*c))) == NULL) {
+			fprintf(stderr, "Can't allocate checkpoint: %s\n", strerror(errno));
+			exit(1);
+		}
+		checkpoints = c;
+	}
+
+	c = &checkpoints[count++];
+	c->state = *reverseCPU;
+	c->pages = NULL;
+	used += sizeof(*c);
+	memset(reverseSaved, 0, savedBytes);
+
+	trim();
+}
+
+void reverseSavePage(uint32_t page)
+{
+	struct checkpoint *c = &checkpoints[count - 1];
+	uint64_t start = (uint64_t)page << REVERSE_PAGE_SHIFT;
+	uint64_t length = REVERSE_PAGE_SIZE;
+	struct savedPage *p;
+
+	reverseSaved[page / 8] |= 1 << (page % 8);
+
+	if ((p = malloc(sizeof(*p))) == NULL) {
+		fprintf(stderr, "Can't allocate checkpoint page: %s\n", strerror(errno));
+		exit(1);
+	}
+	if (start + length > reverseCPU->memSize) {
+		length = reverseCPU->memSize - start;
+	}
+	p->page = page;
+	memcpy(p->data, reverseCPU->mem + start, length);
+	p->next = c->pages;
+	c->pages = p;
+	used += sizeof(*p);
+
+	trim();
+
+	/*
+	 * The newest checkpoint alone is over the budget: forget it and stop
+	 * saving pages until the next one.
+	 */
+	if (used > budget && count == 1 && phase == PHASE_IDLE) {
+		dropOldest();
+		memset(reverseSaved, 0xFF, savedBytes);
+	}
+}
+
+/*
+ * Rewind to checkpoint 'k', which becomes the newest one.
+ */
+static void restore(int k)
+{
+	struct savedPage *p;
+	uint64_t start, length;
+	int i;
+
+	for (i = count - 1; i >= k; i--) {
+		for (p = checkpoints[i].pages; p != NULL; p = p->next) {
+			start = (uint64_t)p->page << REVERSE_PAGE_SHIFT;
+			length = REVERSE_PAGE_SIZE;
+			if (start + length > reverseCPU->memSize) {
+				length = reverseCPU->memSize - start;
+			}
+			memcpy(reverseCPU->mem + start, p->data, length);
+		}
+		freePages(&checkpoints[i]);
+	}
+	used -= (count - k - 1) * sizeof(*checkpoints);
+	count = k + 1;
+
+	*reverseCPU = checkpoints[k].state;
+	memset(reverseSaved, 0, savedBytes);
+	reverseNext = reverseCPU->ic + interval;
+}
+
+int reverseStart(int mode)
+{
+	int k;
+
+	for (k = count - 1; k >= 0 && checkpoints[k].state.ic >= reverseCPU->ic; k--) {
+	}
+	if (k < 0) {
+		return -1;
+	}
+
+	searchMode = mode;
+	segment = k;
+	segmentEnd = reverseCPU->ic;
+	found = NONE;
+	phase = PHASE_SEARCH;
+	restore(k);
+
+	return 0;
+}
+
+int reverseActive()
+{
+	return phase != PHASE_IDLE;
+}
+
+int reverseReplay(int stops)
+{
+	if (phase == PHASE_SEARCH) {
+		if (reverseCPU->ic < segmentEnd) {
+			if (stops || searchMode == REVERSE_STEP) {
+				found = reverseCPU->ic;
+			}
+			return 1;
+		}
+
+		if (found != NONE) {
+			restore(segment);
+			target = found;
+			phase = PHASE_GOTO;
+			return 0;
+		}
+
+		/*
+		 * Nothing in this segment, try the one before. With no segment
+		 * left, stop at the oldest recorded instruction.
+		 */
+		if (segment == 0) {
+			restore(0);
+			phase = PHASE_IDLE;
+			return 0;
+		}
+		segmentEnd = checkpoints[segment].state.ic;
+		restore(--segment);
+		return 0;
+	}
+
+	if (reverseCPU->ic < target) {
+		return 1;
+	}
+	phase = PHASE_IDLE;
+	return 0;
+}
@@ -0,0 +1,109 @@
+#ifndef __REVERSE_H
+#define __REVERSE_H
+
+#include <inttypes.h>
+
+#include "cpu.h"
+
+/*
+ * Reverse execution for the debugger.
+ *
+ * Every 'interval' instructions the CPU state is saved in a checkpoint.
+ * Between checkpoints, the first write to each guest page saves its old
+ * contents in the newest checkpoint, so going back to a checkpoint is
+ * copying those pages back, newest first. Any later point is reached by
+ * running forward again from the checkpoint before it.
+ *
+ * Only the CPU and guest memory go back, including memory written by DMA,
+ * the block device and SPI bursts. Devices keep their state and replays
+ * repeat their side effects (console output, disk writes), so replays
+ * are only exact for code that doesn't talk to devices in between.
+ */
+#define REVERSE_PAGE_SHIFT 12
+#define REVERSE_PAGE_SIZE (1 << REVERSE_PAGE_SHIFT)
+
+#define REVERSE_STEP     0
+#define REVERSE_CONTINUE 1
+
+/*
+ * One bit per guest page, set once the page is saved in the newest
+ * checkpoint. NULL unless reverse execution is on.
+ */
+extern uint8_t *reverseSaved;
+
+/*
+ * Instruction count at which reverseCheckpoint() is due.
+ */
+extern uint64_t reverseNext;
+
+/*
+ * Parse 'config' as [<interval>][,<budget>], the budget being the memory
+ * checkpoints may use in MB, and start recording.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int reverseInit(struct cpuState *cpu, char *config);
+
+void reverseFree();
+
+/*
+ * Save the CPU state as a new checkpoint. Called when cpu->ic reaches
+ * reverseNext, at the point of the main loop where execution resumes
+ * after going back.
+ */
+void reverseCheckpoint();
+
+/*
+ * Save guest page 'page' before its first write since the last
+ * checkpoint.
+ */
+void reverseSavePage(uint32_t page);
+
+/*
+ * Save the pages of [address, address + size) that weren't saved since
+ * the last checkpoint. Devices call it before writing guest memory.
+ */
+static inline void reverseWriteRange(uint32_t address, uint64_t size)
+{
+	uint32_t page, last;
+
+	if ((reverseSaved == NULL) || (size == 0)) {
+		return;
+	}
+	last = ((uint64_t)address + size - 1) >> REVERSE_PAGE_SHIFT;
+	for (page = address >> REVERSE_PAGE_SHIFT; page <= last; page++) {
+		if (((reverseSaved[page / 8] >> (page % 8)) & 1) == 0) {
+			reverseSavePage(page);
+		}
+	}
+}
+
+/*
+ * Go back to the previous instruction (REVERSE_STEP) or to the previous
+ * instruction where the debugger would have stopped (REVERSE_CONTINUE).
+ * The state is rewound right away and reverseReplay() then runs the
+ * search forward.
+ *
+ * On success, returns 0.
+ * If there is no recorded history before the current instruction,
+ * returns -1.
+ */
+int reverseStart(int mode);
+
+/*
+ * Returns 1 while a reverse command is running forward again.
+ */
+int reverseActive();
+
+/*
+ * Called before every instruction while reverseActive(). 'stops' tells
+ * whether the debugger would stop at it.
+ *
+ * Returns 1 if the instruction should run without the debugger. Returns
+ * 0 if the state was rewound again or the target was reached, and the
+ * caller should look at the current instruction again.
+ */
+int reverseReplay(int stops);
+
+#endif /* __REVERSE_H */
@@ -0,0 +1,300 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "spi.h"
+
+/*
+ * SD card in SPI mode (SPI mode 0), backed by an image file. It answers
+ * the commands a boot loader needs: CMD0, CMD8, CMD16, CMD17, CMD24,
+ * CMD55/ACMD41 and CMD58. The card reports itself as high capacity, so
+ * CMD17 and CMD24 take sector numbers.
+ */
+#define SD_SECTOR        512
+
+#define R1_IDLE          0x01
+#define R1_ILLEGAL       0x04
+#define R1_ADDRESS       0x20
+#define R1_PARAMETER     0x40
+
+#define TOKEN_DATA       0xFE
+#define DATA_ACCEPTED    0x05
+#define DATA_WRITE_ERROR 0x0D
+
+#define OCR_READY        0x80000000
+#define OCR_CCS          0x40000000
+#define OCR_VOLTAGE      0x00FF8000
+
+enum sdState {
+	SD_COMMAND,
+	SD_WRITE_TOKEN,
+	SD_WRITE_DATA,
+};
+
+static int imageFd = -1;
+static uint64_t imageSize;
+static uint32_t capacity;
+
+static int selected;
+static int idle = 1;
+static int application;
+static enum sdState state;
+
+static uint8_t command[6];
+static int commandLength;
+
+/*
+ * Bytes to shift out: the response to the last command, at most Ncr, R1,
+ * the data token, a data block and its CRC.
+ */
+static uint8_t response[1 + 1 + 1 + SD_SECTOR + 2];
+static int responseHead;
+static int responseLength;
+
+static uint32_t writeSector;
+static uint8_t block[SD_SECTOR + 2];
+static int blockLength;
+
+static uint64_t sectorsRead;
+static uint64_t sectorsWritten;
+
+static int sdcardOpen(char *config)
+{
+	struct stat statBuffer;
+
+	if (config == NULL) {
+		fprintf(stderr, "The SD card needs an image, as sd=<imagePath>.\n");
+		return -1;
+	}
+
+	if (((imageFd = open(config, O_RDWR)) < 0) ||
+		(fstat(imageFd, &statBuffer) < 0)) {
+		fprintf(stderr, "Can't open SD card image '%s': %s\n", config, strerror(errno));
+		return -1;
+	}
+	imageSize = statBuffer.st_size;
+	capacity = (imageSize + SD_SECTOR - 1) / SD_SECTOR;
+
+	return 0;
+}
+
+static void sdcardClose()
+{
+	if (imageFd >= 0) {
+		close(imageFd);
+		imageFd = -1;
+	}
+}
+
+static void sdcardReport(FILE *f)
+{
+	fprintf(f, "SD card: %" PRIu64 " sectors read, %" PRIu64 " written\n",
+	        sectorsRead, sectorsWritten);
+}
+
+static void sdcardSelect(int active)
+{
+	/*
+	 * A command or data block cut short by deselecting is dropped.
+	 */
+	selected = active;
+	commandLength = 0;
+	if (state == SD_WRITE_DATA) {
+		state = SD_COMMAND;
+	}
+}
+
+static void respond(uint8_t byte)
+{
+	response[responseLength++] = byte;
+}
+
+static void respond32(uint32_t value)
+{
+	respond(value >> 24);
+	respond(value >> 16);
+	respond(value >> 8);
+	respond(value);
+}
+
+/*
+ * Read 'sector' from the image, the part past its end reads as zeros.
+ */
+static int readSector(uint32_t sector, uint8_t *data)
+{
+	ssize_t n = pread(imageFd, data, SD_SECTOR, (uint64_t)sector * SD_SECTOR);
+
+	if (n < 0) {
+		return -1;
+	}
+	memset(data + n, 0, SD_SECTOR - n);
+	return 0;
+}
+
+static int writeSectorData(uint32_t sector, uint8_t *data)
+{
+	uint64_t offset = (uint64_t)sector * SD_SECTOR;
+	uint64_t inImage = imageSize - offset < SD_SECTOR ? imageSize - offset : SD_SECTOR;
+
+	return pwrite(imageFd, data, inImage, offset) == inImage ? 0 : -1;
+}
+
+static void execute()
+{
+	uint8_t index = command[0] & 0x3F;
+	uint32_t argument = (command[1] << 24) | (command[2] << 16) | (command[3] << 8) | command[4];
+	uint8_t r1 = idle ? R1_IDLE : 0;
+	int wasApplication = application;
+
+	responseHead = 0;
+	responseLength = 0;
+	application = 0;
+
+	/*
+	 * One byte of Ncr before the response.
+	 */
+	respond(0xFF);
+
+	if (wasApplication && index == 41) {
+		/*
+		 * ACMD41: initialization finishes right away.
+		 */
+		idle = 0;
+		respond(0);
+		return;
+	}
+
+	switch (index) {
+		case 0:
+			idle = 1;
+			respond(R1_IDLE);
+			break;
+		case 8:
+			respond(r1);
+			respond32(argument & 0xFFF);
+			break;
+		case 16:
+			respond(argument == SD_SECTOR ? r1 : r1 | R1_PARAMETER);
+			break;
+		case 17:
+			if (idle) {
+				respond(r1 | R1_ILLEGAL);
+			} else if (argument >= capacity) {
+				respond(r1 | R1_ADDRESS);
+			} else {
+				respond(r1);
+				respond(TOKEN_DATA);
+				if (readSector(argument, response + responseLength) < 0) {
+					/*
+					 * Data error token: card ECC failed.
+					 */
+					response[responseLength - 1] = 0x04;
+					break;
+				}
+				responseLength += SD_SECTOR;
+				respond(0xFF);
+				respond(0xFF);
+				sectorsRead++;
+			}
+			break;
+		case 24:
+			if (idle) {
+				respond(r1 | R1_ILLEGAL);
+			} else if (argument >= capacity) {
+				respond(r1 | R1_ADDRESS);
+			} else {
+				respond(r1);
+				writeSector = argument;
+				state = SD_WRITE_TOKEN;
+			}
+			break;
+		case 55:
+			application = 1;
+			respond(r1);
+			break;
+		case 58:
+			respond(r1);
+			respond32(OCR_VOLTAGE | OCR_CCS | (idle ? 0 : OCR_READY));
+			break;
+		default:
+			respond(r1 | R1_ILLEGAL);
+			break;
+	}
+}
+
+static void receiveBlockByte(uint8_t data)
+{
+	block[blockLength++] = data;
+	if (blockLength < sizeof(block)) {
+		return;
+	}
+
+	/*
+	 * Data response, then busy (MISO low) for a byte.
+	 */
+	responseHead = 0;
+	responseLength = 0;
+	if (writeSectorData(writeSector, block) < 0) {
+		respond(DATA_WRITE_ERROR);
+	} else {
+		respond(DATA_ACCEPTED);
+		sectorsWritten++;
+	}
+	respond(0x00);
+	state = SD_COMMAND;
+}
+
+static uint8_t sdcardExchange(uint8_t data)
+{
+	uint8_t out = 0xFF;
+
+	if (!selected) {
+		return out;
+	}
+	if (responseHead < responseLength) {
+		out = response[responseHead++];
+	}
+
+	switch (state) {
+		case SD_COMMAND:
+			/*
+			 * A command starts with 01 in the top bits, anything else
+			 * between commands is the host clocking out the response.
+			 */
+			if (commandLength == 0 && (data & 0xC0) != 0x40) {
+				break;
+			}
+			command[commandLength++] = data;
+			if (commandLength == sizeof(command)) {
+				commandLength = 0;
+				execute();
+			}
+			break;
+		case SD_WRITE_TOKEN:
+			if (data == TOKEN_DATA) {
+				blockLength = 0;
+				state = SD_WRITE_DATA;
+			}
+			break;
+		case SD_WRITE_DATA:
+			receiveBlockByte(data);
+			break;
+	}
+
+	return out;
+}
+
+struct spiSlave sdcardSlave = {
+	"sd",
+	0,
+	sdcardOpen,
+	sdcardSelect,
+	sdcardExchange,
+	sdcardReport,
+	sdcardClose,
+};
@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "spi.h"
+#include "reverse.h"
+
+static struct cpuState *spiCPU;
+
+static struct spiSlave *availableSlaves[] = {
+	&sdcardSlave,
+	&lcdSlave,
+};
+
+static struct spiSlave *slaves[SPI_SLAVES];
+static int numSlaves;
+
+static uint32_t control;
+static uint8_t din;
+static uint8_t dout;
+static int busy;
+static int countdown;
+
+static uint32_t burstAddress;
+static uint32_t burstLength;
+static uint32_t burstMode;
+static uint32_t burstStatus;
+
+void spiInit(struct cpuState *cpu)
+{
+	spiCPU = cpu;
+}
+
+int spiAttach(char *config)
+{
+	char *name = strdup(config);
+	char *options;
+	int i, n;
+
+	if ((options = strchr(name, '=')) != NULL) {
+		*options++ = '\0';
+	}
+
+	if (numSlaves == SPI_SLAVES) {
+		fprintf(stderr, "Too many SPI slaves, there are %d select lines.\n", SPI_SLAVES);
+		goto ERROR;
+	}
+
+	for (i = 0; i < sizeof(availableSlaves) / sizeof(*availableSlaves); i++) {
+		if (strcmp(name, availableSlaves[i]->name) == 0) {
+			break;
+		}
+	}
+	if (i == sizeof(availableSlaves) / sizeof(*availableSlaves)) {
+		fprintf(stderr, "Unknown SPI slave '%s' (sd, lcd)\n", name);
+		goto ERROR;
+	}
+
+	/*
+	 * Each slave model keeps its state in statics, so it can only sit on
+	 * one select line.
+	 */
+	for (n = 0; n < numSlaves; n++) {
+		if (slaves[n] == availableSlaves[i]) {
+			fprintf(stderr, "SPI slave '%s' is already attached.\n", name);
+			goto ERROR;
+		}
+	}
+	if (availableSlaves[i]->open(options) < 0) {
+		goto ERROR;
+	}
+	slaves[numSlaves++] = availableSlaves[i];
+
+	free(name);
+	return 0;
+
+ERROR:
+	free(name);
+	return -1;
+}
+
+void spiClose(FILE *f)
+{
+	int i;
+
+	for (i = 0; i < numSlaves; i++) {
+		if (slaves[i]->report != NULL) {
+			slaves[i]->report(f);
+		}
+		slaves[i]->close();
+	}
+	numSlaves = 0;
+}
+
+static void setSelect(uint32_t ss)
+{
+	uint32_t changed = ((control & SPI_SS_MASK) ^ ss) >> SPI_SS_SHIFT;
+	int i;
+
+	for (i = 0; i < numSlaves; i++) {
+		if (changed & (1 << i)) {
+			slaves[i]->select((ss >> (SPI_SS_SHIFT + i)) & 1);
+		}
+	}
+}
+
+/*
+ * Every selected slave sampling in the current mode sees the byte. MISO
+ * idles high, so a slave that is not driving it reads as ones.
+ */
+static uint8_t shift(uint8_t data)
+{
+	int mode = ((control & SPI_CPOL) ? 2 : 0) | ((control & SPI_CPHA) ? 1 : 0);
+	uint8_t miso = 0xFF;
+	int i;
+
+	for (i = 0; i < numSlaves; i++) {
+		if ((control & (1 << (SPI_SS_SHIFT + i))) && slaves[i]->mode == mode) {
+			miso &= slaves[i]->exchange(data);
+		}
+	}
+	return miso;
+}
+
+static void startByte(uint8_t data)
+{
+	din = data;
+	busy = 1;
+	countdown = SPI_BYTE_TICKS;
+}
+
+static void burstNext()
+{
+	startByte((burstMode & SPI_BURST_RECEIVE) ? 0xFF : spiCPU->mem[burstAddress]);
+}
+
+static void burstFinish(uint32_t result)
+{
+	burstStatus = result;
+	spiCPU->intPending |= 1 << INT_SPI;
+}
+
+static void burstStart(uint32_t mode)
+{
+	if (busy || !isMemory(spiCPU, burstAddress, burstLength)) {
+		burstFinish(SPI_BURST_DONE | SPI_BURST_ERROR);
+		return;
+	}
+	if (burstLength == 0) {
+		burstFinish(SPI_BURST_DONE);
+		return;
+	}
+
+	burstMode = mode;
+	burstStatus = SPI_BURST_BUSY;
+	burstNext();
+}
+
+uint32_t spiRead(uint32_t offset)
+{
+	switch (offset & ~0x3) {
+		case SPI_CONTROL:
+			return control | (busy ? SPI_BUSY : 0);
+		case SPI_INPUT:
+			return din;
+		default:
+			return dout;
+	}
+}
+
+void spiWrite(uint32_t offset, uint32_t data)
+{
+	switch (offset & ~0x3) {
+		case SPI_CONTROL:
+			setSelect(data & SPI_SS_MASK);
+			control = data & (SPI_CPOL | SPI_CPHA | SPI_SS_MASK);
+			if (data & SPI_RESET) {
+				busy = 0;
+				dout = 0;
+				if (burstStatus & SPI_BURST_BUSY) {
+					burstFinish(SPI_BURST_DONE | SPI_BURST_ERROR);
+				}
+			}
+			break;
+		case SPI_INPUT:
+			if (!busy) {
+				startByte(data & 0xFF);
+			}
+			break;
+	}
+}
+
+uint32_t spiBurstRead(uint32_t offset)
+{
+	switch (offset & ~0x3) {
+		case SPI_BURST_ADDRESS:
+			return burstAddress;
+		case SPI_BURST_LENGTH:
+			return burstLength;
+		default:
+			return burstStatus;
+	}
+}
+
+void spiBurstWrite(uint32_t offset, uint32_t data)
+{
+	/*
+	 * The address registers are read only during a burst.
+	 */
+	if ((burstStatus & SPI_BURST_BUSY) && ((offset & ~0x3) != SPI_BURST_CONTROL)) {
+		return;
+	}
+
+	switch (offset & ~0x3) {
+		case SPI_BURST_ADDRESS:
+			burstAddress = data;
+			break;
+		case SPI_BURST_LENGTH:
+			burstLength = data;
+			break;
+		default:
+			if (burstStatus & SPI_BURST_BUSY) {
+				break;
+			}
+			if (data & SPI_BURST_START) {
+				burstStart(data);
+			} else {
+				burstStatus = 0;
+			}
+			break;
+	}
+}
+
+int spiBusy()
+{
+	return busy;
+}
+
+void spiTick()
+{
+	if (--countdown != 0) {
+		return;
+	}
+	dout = shift(din);
+	busy = 0;
+
+	if ((burstStatus & SPI_BURST_BUSY) == 0) {
+		return;
+	}
+	if (burstMode & SPI_BURST_RECEIVE) {
+		reverseWriteRange(burstAddress, 1);
+		spiCPU->mem[burstAddress] = dout;
+	}
+	burstAddress++;
+	if (--burstLength == 0) {
+		burstFinish(SPI_BURST_DONE);
+	} else {
+		burstNext();
+	}
+}
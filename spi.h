@@ -0,0 +1,128 @@
+#ifndef __SPI_H
+#define __SPI_H
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+/*
+ * SPI master registers, relative to the memory mapped I/O region. They
+ * follow hdl/spi_master.v:
+ *
+ * Control holds CPOL (bit 0), CPHA (bit 1) and the eight slave select
+ * lines (bits 8 to 15, a set bit selects that slave). Writing
+ * SPI_RESET returns the master to idle. SPI_BUSY reads set while a byte
+ * is being shifted.
+ *
+ * Writing Input (din) shifts its low byte out on MOSI while the byte on
+ * MISO is shifted in. Output (dout) holds it once SPI_BUSY clears. With
+ * no slave selected, MISO reads all ones.
+ */
+#define SPI_BASE          0x9C
+#define SPI_SIZE          0xC
+
+#define SPI_CONTROL       0x0
+#define SPI_INPUT         0x4
+#define SPI_OUTPUT        0x8
+
+#define SPI_CPOL          0x1
+#define SPI_CPHA          0x2
+#define SPI_RESET         0x4
+#define SPI_SS_SHIFT      8
+#define SPI_SS_MASK       0xFF00
+#define SPI_BUSY          0x10000
+
+/*
+ * Burst registers, an emulator extension after the console. Writing
+ * SPI_BURST_START to Burst Control moves Burst Length bytes between the
+ * bus and guest memory at Burst Address, one after the other at the
+ * same rate as single bytes: sent from memory (received bytes are
+ * dropped) or, with SPI_BURST_RECEIVE, received into memory (sending
+ * all ones). Burst Control then reads SPI_BURST_DONE and the INT_SPI
+ * interrupt becomes pending.
+ */
+#define SPI_BURST_BASE    0xE0
+#define SPI_BURST_SIZE    0xC
+
+#define SPI_BURST_ADDRESS 0x0
+#define SPI_BURST_LENGTH  0x4
+#define SPI_BURST_CONTROL 0x8
+
+#define SPI_BURST_START   0x1
+#define SPI_BURST_RECEIVE 0x2
+
+#define SPI_BURST_BUSY    0x1
+#define SPI_BURST_DONE    0x2
+#define SPI_BURST_ERROR   0x4
+
+/*
+ * Instructions per byte: the Verilog toggles SCK on every clock, 16
+ * edges plus the clock that returns to idle.
+ */
+#define SPI_BYTE_TICKS    17
+
+#define SPI_SLAVES        8
+
+/*
+ * A device on the bus. 'mode' is the SPI mode it samples in
+ * (CPOL << 1 | CPHA); bytes shifted in any other mode are garbage to
+ * it, so it ignores them and leaves MISO high.
+ */
+struct spiSlave {
+	const char *name;
+	int mode;
+
+	/*
+	 * Attach to 'config' (may be NULL). Returns 0 or -1 on error.
+	 */
+	int (*open)(char *config);
+
+	/*
+	 * The slave select line went active (1) or inactive (0).
+	 */
+	void (*select)(int selected);
+
+	/*
+	 * Shift one byte in, return the byte shifted out at the same time.
+	 */
+	uint8_t (*exchange)(uint8_t data);
+
+	void (*report)(FILE *f);
+	void (*close)();
+};
+
+extern struct spiSlave sdcardSlave;
+extern struct spiSlave lcdSlave;
+
+void spiInit(struct cpuState *cpu);
+
+/*
+ * Attach a slave on the next free select line, given as
+ * <slave>[=<config>]: sd=<imagePath> or lcd[=<pbmPath>].
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int spiAttach(char *config);
+
+/*
+ * Report on and detach all slaves.
+ */
+void spiClose(FILE *f);
+
+uint32_t spiRead(uint32_t offset);
+void spiWrite(uint32_t offset, uint32_t data);
+uint32_t spiBurstRead(uint32_t offset);
+void spiBurstWrite(uint32_t offset, uint32_t data);
+
+/*
+ * Returns 1 while a byte is being shifted.
+ */
+int spiBusy();
+
+/*
+ * Advance the byte in progress. Called once per instruction while busy.
+ */
+void spiTick();
+
+#endif /* __SPI_H */
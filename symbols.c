@@ -0,0 +1,307 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "symbols.h"
+#include "dbi.h"
+
+typedef struct Symbol
+{
+	const char *name;
+	uint32_t address;
+	uint32_t end;
+	uint32_t limit; // End of the binary the label came from.
+	int owned;      // Else the name is in a mapped debug info file.
+} Symbol;
+
+typedef struct MappedTable
+{
+	const struct dbiHeader *dbi;
+	size_t size;
+	struct MappedTable *next;
+} MappedTable;
+
+static Symbol *gSymbols;
+static int *gByName; // Symbol indexes sorted by name.
+static int gSymbolCount;
+static int gSymbolAlloc;
+static MappedTable *gMapped;
+
+static int compareSymbols(const void *a, const void *b)
+{
+	const Symbol *l = a;
+	const Symbol *r = b;
+
+	if (l->address < r->address) {
+		return -1;
+	}
+	if (l->address > r->address) {
+		return 1;
+	}
+	return 0;
+}
+
+static int compareNames(const void *a, const void *b)
+{
+	return strcmp(gSymbols[*(const int *)a].name, gSymbols[*(const int *)b].name);
+}
+
+/*
+ * Sort by address and compute where each symbol ends. A symbol ends
+ * where the next one starts or where its binary ends. Then sort the name
+ * index, so both lookups are binary searches.
+ */
+static void indexSymbols()
+{
+	int i;
+
+	qsort(gSymbols, gSymbolCount, sizeof(*gSymbols), compareSymbols);
+
+	for (i = 0; i < gSymbolCount; i++) {
+		gSymbols[i].end = gSymbols[i].limit;
+		if ((i + 1 < gSymbolCount) &&
+			(gSymbols[i + 1].address < gSymbols[i].end)) {
+			gSymbols[i].end = gSymbols[i + 1].address;
+		}
+		gByName[i] = i;
+	}
+
+	qsort(gByName, gSymbolCount, sizeof(*gByName), compareNames);
+}
+
+/*
+ * Make room for 'count' more symbols.
+ */
+static int reserveSymbols(int count)
+{
+	int n = gSymbolAlloc == 0 ? 64 : gSymbolAlloc;
+	Symbol *s;
+	int *byName;
+
+	if (gSymbolCount + count <= gSymbolAlloc) {
+		return 0;
+	}
+	while (n < gSymbolCount + count) {
+		n *= 2;
+	}
+	if ((s = realloc(gSymbols, n * sizeof(*s))) == NULL) {
+		fprintf(stderr, "Can't allocate symbols: %s\n", strerror(errno));
+		return -1;
+	}
+	gSymbols = s;
+	if ((byName = realloc(gByName, n * sizeof(*byName))) == NULL) {
+		fprintf(stderr, "Can't allocate symbols: %s\n", strerror(errno));
+		return -1;
+	}
+	gByName = byName;
+	gSymbolAlloc = n;
+
+	return 0;
+}
+
+int symbolsLoad(char *fileName, uint32_t endAddr)
+{
+	FILE *f;
+	char line[4096];
+	char name[4096];
+	char value[4096];
+
+	if ((f = fopen(fileName, "r")) == NULL) {
+		fprintf(stderr, "Can't open '%s': %s\n", fileName, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%s %s", name, value) != 2 || name[0] != '.') {
+			continue;
+		}
+
+		if (reserveSymbols(1) < 0) {
+			fclose(f);
+			return -1;
+		}
+
+		gSymbols[gSymbolCount].name = strdup(name + 1);
+		gSymbols[gSymbolCount].address = strtoul(value, NULL, 0);
+		gSymbols[gSymbolCount].limit = endAddr;
+		gSymbols[gSymbolCount].owned = 1;
+		gSymbolCount++;
+	}
+	fclose(f);
+
+	indexSymbols();
+
+	return 0;
+}
+
+int symbolsLoadDebug(char *fileName, uint32_t endAddr)
+{
+	const struct dbiSymbol *symbols;
+	MappedTable *table;
+	uint32_t i;
+
+	if ((table = malloc(sizeof(*table))) == NULL) {
+		fprintf(stderr, "Can't allocate symbols: %s\n", strerror(errno));
+		return -1;
+	}
+	if ((table->dbi = dbiMap(fileName, &table->size)) == NULL) {
+		free(table);
+		return -1;
+	}
+	if (reserveSymbols(table->dbi->symbolCount) < 0) {
+		dbiUnmap(table->dbi, table->size);
+		free(table);
+		return -1;
+	}
+	table->next = gMapped;
+	gMapped = table;
+
+	/*
+	 * The names stay in the mapping, only the table gets merged.
+	 */
+	symbols = dbiSymbols(table->dbi);
+	for (i = 0; i < table->dbi->symbolCount; i++) {
+		gSymbols[gSymbolCount].name = dbiString(table->dbi, symbols[i].name);
+		gSymbols[gSymbolCount].address = symbols[i].address;
+		gSymbols[gSymbolCount].limit = endAddr;
+		gSymbols[gSymbolCount].owned = 0;
+		gSymbolCount++;
+	}
+
+	indexSymbols();
+
+	return 0;
+}
+
+void symbolsFree()
+{
+	int i;
+
+	for (i = 0; i < gSymbolCount; i++) {
+		if (gSymbols[i].owned) {
+			free((char *)gSymbols[i].name);
+		}
+	}
+	free(gSymbols);
+	free(gByName);
+
+	while (gMapped != NULL) {
+		MappedTable *table = gMapped;
+		gMapped = table->next;
+		dbiUnmap(table->dbi, table->size);
+		free(table);
+	}
+
+	gSymbols = NULL;
+	gByName = NULL;
+	gSymbolCount = 0;
+	gSymbolAlloc = 0;
+}
+
+/*
+ * Binary search for the last symbol starting at or before 'address'.
+ */
+static int findFloor(uint32_t address)
+{
+	int lo = 0;
+	int hi = gSymbolCount - 1;
+	int found = -1;
+
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+
+		if (gSymbols[mid].address <= address) {
+			found = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	return found;
+}
+
+int symbolsFind(uint32_t address)
+{
+	int i = findFloor(address);
+
+	if (i < 0 || address >= gSymbols[i].end) {
+		return -1;
+	}
+	return i;
+}
+
+int symbolsExact(uint32_t address)
+{
+	int i = findFloor(address);
+
+	if (i < 0 || gSymbols[i].address != address) {
+		return -1;
+	}
+	return i;
+}
+
+int symbolsLookupName(const char *name, uint32_t *address)
+{
+	int lo = 0;
+	int hi = gSymbolCount - 1;
+
+	if (name[0] == '.') {
+		name++;
+	}
+
+	while (lo <= hi) {
+		int mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(gSymbols[gByName[mid]].name, name);
+
+		if (cmp == 0) {
+			*address = gSymbols[gByName[mid]].address;
+			return 0;
+		}
+		if (cmp < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	return -1;
+}
+
+int symbolsFormat(uint32_t address, char *buf, size_t size)
+{
+	int i = symbolsFind(address);
+
+	if (i < 0) {
+		snprintf(buf, size, "0x%" PRIX32, address);
+		return -1;
+	}
+	if (address == gSymbols[i].address) {
+		snprintf(buf, size, "%s", gSymbols[i].name);
+	} else {
+		snprintf(buf, size, "%s+0x%" PRIX32, gSymbols[i].name, address - gSymbols[i].address);
+	}
+	return 0;
+}
+
+int symbolsCount()
+{
+	return gSymbolCount;
+}
+
+const char *symbolsName(int index)
+{
+	return gSymbols[index].name;
+}
+
+uint32_t symbolsAddress(int index)
+{
+	return gSymbols[index].address;
+}
+
+uint32_t symbolsEnd(int index)
+{
+	return gSymbols[index].end;
+}
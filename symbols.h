@@ -0,0 +1,66 @@
+#ifndef __SYMBOLS_H
+#define __SYMBOLS_H
+
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+ * Load the exported labels from a *.sym file as produced by
+ * `assembler.py --symbols`. Each line looks like ".label 0xADDRESS".
+ *
+ * The last label of the file is assumed to extend up to 'endAddr',
+ * normally the end of the binary the labels belong to.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int symbolsLoad(char *fileName, uint32_t endAddr);
+
+/*
+ * Same as symbolsLoad() for the symbol table of a binary debug info file
+ * (see dbi.h). The file stays mapped and the names are used in place.
+ */
+int symbolsLoadDebug(char *fileName, uint32_t endAddr);
+
+/*
+ * Free every loaded symbol.
+ */
+void symbolsFree();
+
+/*
+ * Returns the index of the symbol whose [address, end) range contains
+ * 'address' or -1 if no symbol covers it. This is a binary search.
+ */
+int symbolsFind(uint32_t address);
+
+/*
+ * Returns the index of the symbol located exactly at 'address' or -1.
+ */
+int symbolsExact(uint32_t address);
+
+/*
+ * Look up the address of the label called 'name' (with or without the
+ * leading '.').
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int symbolsLookupName(const char *name, uint32_t *address);
+
+/*
+ * Write 'address' to 'buf' as "label" or "label+0xOFFSET" if a symbol
+ * covers it, else as "0xADDRESS". Costs one symbolsFind().
+ *
+ * Returns 0 if a symbol covers it, -1 otherwise.
+ */
+int symbolsFormat(uint32_t address, char *buf, size_t size);
+
+/*
+ * Accessors for the sorted symbol table.
+ */
+int symbolsCount();
+const char *symbolsName(int index);
+uint32_t symbolsAddress(int index);
+uint32_t symbolsEnd(int index);
+
+#endif /* __SYMBOLS_H */
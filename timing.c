@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "timing.h"
+#include "isa.h"
+
+#define OPCODE(x) [x] = #x
+
+static const char *opcodeNames[256] = {
+	OPCODE(nop),
+	OPCODE(add), OPCODE(sub), OPCODE(adc), OPCODE(sbc), OPCODE(mul), OPCODE(div),
+	OPCODE(ldw), OPCODE(ldb), OPCODE(stw), OPCODE(stb),
+	OPCODE(mov),
+	OPCODE(and), OPCODE(or), OPCODE(xor), OPCODE(nor), OPCODE(lsl), OPCODE(lsr),
+	OPCODE(cmp), OPCODE(jmp), OPCODE(jz), OPCODE(jnz), OPCODE(jl), OPCODE(jge),
+	OPCODE(in), OPCODE(out),
+	OPCODE(die)
+};
+
+/*
+ * hdl/cpu.v runs its state machine on 'enable', which toggles every
+ * Clk, so one state takes two clocks. Each instruction spends 8 states
+ * in FETCH (one BRAM byte per state), 1 in DECODE and 1 in EXECUTE.
+ * Word loads and stores stay in EXECUTE for 4 states to move 4 bytes.
+ * Memory mapped I/O is a register access and takes a single EXECUTE.
+ */
+#define FSM_FETCH   8
+#define FSM_DECODE  1
+#define FSM_EXECUTE 1
+
+static uint32_t cycleTable[256];
+static uint32_t mmioCycles = FSM_FETCH + FSM_DECODE + FSM_EXECUTE;
+static uint32_t divider = 2;
+
+static uint64_t opCount[256];
+static uint64_t mmioCount;
+
+const char *opcodeName(uint8_t op)
+{
+	return opcodeNames[op];
+}
+
+static int parseTimingFile(char *fileName)
+{
+	FILE *f;
+	char line[4096];
+	char name[4096];
+	uint32_t cycles;
+	int lineNum = 0;
+	int i;
+
+	if ((f = fopen(fileName, "r")) == NULL) {
+		fprintf(stderr, "Can't open '%s': %s\n", fileName, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		lineNum++;
+		if (sscanf(line, "%s %" SCNu32, name, &cycles) != 2 || name[0] == '#') {
+			continue;
+		}
+
+		if (strcmp(name, "divider") == 0) {
+			divider = cycles;
+			continue;
+		}
+		if (strcmp(name, "mmio") == 0) {
+			mmioCycles = cycles;
+			continue;
+		}
+
+		for (i = 0; i < 256; i++) {
+			if (opcodeNames[i] != NULL && strcmp(opcodeNames[i], name) == 0) {
+				cycleTable[i] = cycles;
+				break;
+			}
+		}
+		if (i >= 256) {
+			fprintf(stderr, "%s:%d: Unknown opcode '%s'\n", fileName, lineNum, name);
+			fclose(f);
+			return -1;
+		}
+	}
+	fclose(f);
+
+	return 0;
+}
+
+int timingInit(char *fileName)
+{
+	int i;
+
+	for (i = 0; i < 256; i++) {
+		cycleTable[i] = FSM_FETCH + FSM_DECODE + FSM_EXECUTE;
+	}
+	cycleTable[ldw] = FSM_FETCH + FSM_DECODE + 4 * FSM_EXECUTE;
+	cycleTable[stw] = FSM_FETCH + FSM_DECODE + 4 * FSM_EXECUTE;
+
+	if (fileName != NULL) {
+		return parseTimingFile(fileName);
+	}
+
+	return 0;
+}
+
+void timingInstruction(uint8_t op, int mmio)
+{
+	if (mmio) {
+		mmioCount++;
+	} else {
+		opCount[op]++;
+	}
+}
+
+void timingReport(FILE *stream, uint64_t instructions, double clockHz)
+{
+	uint64_t states = mmioCount * mmioCycles;
+	uint64_t clocks;
+	int i;
+
+	fprintf(stream, "\nTiming model (%" PRIu32 " clocks per state):\n", divider);
+	fprintf(stream, "%10s %14s %14s\n", "opcode", "instructions", "clocks");
+	for (i = 0; i < 256; i++) {
+		if (opCount[i] == 0) {
+			continue;
+		}
+		states += opCount[i] * cycleTable[i];
+		fprintf(stream, "%10s %14" PRIu64 " %14" PRIu64 "\n",
+		        opcodeNames[i] != NULL ? opcodeNames[i] : "???",
+		        opCount[i], opCount[i] * cycleTable[i] * divider);
+	}
+	if (mmioCount != 0) {
+		fprintf(stream, "%10s %14" PRIu64 " %14" PRIu64 "\n",
+		        "mmio", mmioCount, mmioCount * mmioCycles * divider);
+	}
+
+	clocks = states * divider;
+	fprintf(stream, "Instructions: %" PRIu64 "\n", instructions);
+	fprintf(stream, "Clock cycles: %" PRIu64 " (%.2f per instruction)\n", clocks,
+	        instructions == 0 ? 0.0 : (double)clocks / instructions);
+	fprintf(stream, "Wall time:    %.6f s at %.0f Hz\n", clocks / clockHz, clockHz);
+}
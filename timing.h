@@ -0,0 +1,37 @@
+#ifndef __TIMING_H
+#define __TIMING_H
+
+#include <stdio.h>
+
+#include "cpu.h"
+
+/*
+ * Clock cycle model of the multi-cycle state machine in hdl/cpu.v.
+ *
+ * Every opcode is charged a number of state machine cycles taken from a
+ * table, and every state machine cycle takes 'divider' clock cycles.
+ * The defaults follow the Verilog FSM. 'fileName' optionally overrides
+ * them with lines of "<mnemonic> <cycles>", "mmio <cycles>" for loads
+ * and stores that hit memory mapped I/O and "divider <clocks>".
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int timingInit(char *fileName);
+
+/*
+ * Charge one executed instruction.
+ */
+void timingInstruction(uint8_t op, int mmio);
+
+/*
+ * Print total cycles and the estimated wall time at 'clockHz'.
+ */
+void timingReport(FILE *stream, uint64_t instructions, double clockHz);
+
+/*
+ * Returns the assembly mnemonic of an opcode or NULL.
+ */
+const char *opcodeName(uint8_t op);
+
+#endif /* __TIMING_H */
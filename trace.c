@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+
+#include "trace.h"
+#include "symbols.h"
+#include "isa.h"
+
+#define TRACE_BUFFER_SIZE (1024 * 1024)
+#define TRACE_MAX_DEPTH 1024
+
+static FILE *traceFile;
+static char *buffer;
+static size_t bufferUsed;
+static int eventCount;
+
+/*
+ * Shadow call stack of open events. Functions and interrupt handlers
+ * both return through jmp r4, so one stack serves both.
+ */
+static char *stack[TRACE_MAX_DEPTH];
+static int depth;
+static int lastWasCall;
+
+static void flushBuffer()
+{
+	if (bufferUsed > 0) {
+		fwrite(buffer, 1, bufferUsed, traceFile);
+		bufferUsed = 0;
+	}
+}
+
+static void traceWrite(const char *fmt, ...)
+{
+	va_list argPtr;
+	int len;
+
+	if (TRACE_BUFFER_SIZE - bufferUsed < 512) {
+		flushBuffer();
+	}
+
+	va_start(argPtr, fmt);
+	len = vsnprintf(buffer + bufferUsed, TRACE_BUFFER_SIZE - bufferUsed, fmt, argPtr);
+	va_end(argPtr);
+
+	if (len > 0) {
+		bufferUsed += len;
+	}
+}
+
+static void traceEvent(const char *name, const char *category, char phase, uint64_t ic)
+{
+	traceWrite("%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64 ",\"pid\":0,\"tid\":0%s}",
+	           eventCount == 0 ? "\n" : ",\n", name, category, phase, ic,
+	           phase == 'i' ? ",\"s\":\"g\"" : "");
+	eventCount++;
+}
+
+static void push(char *name, const char *category, uint64_t ic)
+{
+	traceEvent(name, category, 'B', ic);
+
+	if (depth < TRACE_MAX_DEPTH) {
+		stack[depth] = name;
+	}
+	depth++;
+}
+
+static void pop(uint64_t ic)
+{
+	if (depth == 0) {
+		return;
+	}
+	depth--;
+
+	if (depth < TRACE_MAX_DEPTH) {
+		traceEvent(stack[depth], "", 'E', ic);
+		free(stack[depth]);
+	} else {
+		traceEvent("", "", 'E', ic);
+	}
+}
+
+int traceOpen(char *fileName)
+{
+	if ((traceFile = fopen(fileName, "w")) == NULL) {
+		fprintf(stderr, "Can't open '%s': %s\n", fileName, strerror(errno));
+		return -1;
+	}
+
+	if ((buffer = malloc(TRACE_BUFFER_SIZE)) == NULL) {
+		fprintf(stderr, "Can't allocate trace buffer: %s\n", strerror(errno));
+		fclose(traceFile);
+		traceFile = NULL;
+		return -1;
+	}
+
+	traceWrite("{\"traceEvents\":[");
+	traceWrite("\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"cpu\"}}");
+	eventCount = 1;
+
+	return 0;
+}
+
+void traceClose(uint64_t ic)
+{
+	if (traceFile == NULL) {
+		return;
+	}
+
+	while (depth > 0) {
+		pop(ic);
+	}
+
+	traceWrite("\n]}\n");
+	flushBuffer();
+
+	fclose(traceFile);
+	traceFile = NULL;
+	free(buffer);
+	buffer = NULL;
+}
+
+void traceInstruction(struct cpuState *cpu, struct instruction *o)
+{
+	int i;
+
+	/*
+	 * By convention a call is an unconditional jump to a label.
+	 * Loops jump back to their own label with a conditional branch,
+	 * so they are not mistaken for calls.
+	 */
+	if (lastWasCall && (i = symbolsExact(cpu->pc)) >= 0) {
+		push(strdup(symbolsName(i)), "function", cpu->ic);
+	}
+
+	lastWasCall = (o->op == jmp) && ((o->mode & MODE_OPERAND) == OPR_IMM);
+
+	/*
+	 * Everything returns with jmp r4.
+	 */
+	if ((o->op == jmp) && ((o->mode & MODE_OPERAND) == OPR_REG) && (o->raw2 == 4)) {
+		pop(cpu->ic);
+	}
+}
+
+void traceInterrupt(uint64_t ic, int interrupt)
+{
+	char *name;
+
+	if (asprintf(&name, "interrupt %d", interrupt) < 0) {
+		return;
+	}
+	push(name, "interrupt", ic);
+	lastWasCall = 0;
+}
+
+void traceDie(uint64_t ic)
+{
+	traceEvent("die", "cpu", 'i', ic);
+}
@@ -0,0 +1,39 @@
+#ifndef __TRACE_H
+#define __TRACE_H
+
+#include "cpu.h"
+
+/*
+ * Write a timeline of guest function calls and interrupts in the Chrome
+ * trace_event JSON format (viewable in Perfetto or chrome://tracing).
+ *
+ * Timestamps are the instruction count, one instruction per microsecond.
+ *
+ * On success, returns 0.
+ * On error, returns -1.
+ */
+int traceOpen(char *fileName);
+
+/*
+ * Close any open events and flush the trace file.
+ */
+void traceClose(uint64_t ic);
+
+/*
+ * Called before each instruction executes. Detects function entry
+ * (an unconditional immediate jmp landing on a .sym label) and function
+ * or interrupt exit (jmp r4).
+ */
+void traceInstruction(struct cpuState *cpu, struct instruction *o);
+
+/*
+ * Record an interrupt handler being entered.
+ */
+void traceInterrupt(uint64_t ic, int interrupt);
+
+/*
+ * Record the die instruction.
+ */
+void traceDie(uint64_t ic);
+
+#endif /* __TRACE_H */